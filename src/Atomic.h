@@ -0,0 +1,100 @@
+/*  Copyright (c) 2013, Leo Kuznetsov
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+#ifndef __ATOMIC_H__
+#define __ATOMIC_H__
+
+#ifdef WIN32
+#include <intrin.h>
+#endif
+
+/* Sequentially consistent operations on 32 and 64 bit ints, bytes and pointers for code shared between Win32 and POSIX */
+
+class Atomic {
+public:
+#ifdef WIN32
+    static inline int load(volatile int* a) { return (int)_InterlockedOr((volatile long*)a, 0); }
+    static inline void store(volatile int* a, int v) { _InterlockedExchange((volatile long*)a, (long)v); }
+    static inline int add(volatile int* a, int v) { return (int)_InterlockedExchangeAdd((volatile long*)a, (long)v) + v; }
+    static inline int exchange(volatile int* a, int v) { return (int)_InterlockedExchange((volatile long*)a, (long)v); }
+    static inline bool compareExchange(volatile int* a, int expected, int v) {
+        return _InterlockedCompareExchange((volatile long*)a, (long)v, (long)expected) == (long)expected;
+    }
+    static inline bool compareExchangePointer(void* volatile* a, void* expected, void* v) {
+        return _InterlockedCompareExchangePointer(a, v, expected) == expected;
+    }
+    static inline void* exchangePointer(void* volatile* a, void* v) { return _InterlockedExchangePointer(a, v); }
+    static inline long long load(volatile long long* a) { return _InterlockedOr64(a, 0); }
+    static inline long long add(volatile long long* a, long long v) { return _InterlockedExchangeAdd64(a, v) + v; }
+    static inline void store(volatile long long* a, long long v) { _InterlockedExchange64(a, v); }
+    static inline bool compareExchange(volatile long long* a, long long expected, long long v) {
+        return _InterlockedCompareExchange64(a, v, expected) == expected;
+    }
+    static inline unsigned char load(volatile unsigned char* a) { return (unsigned char)_InterlockedOr8((volatile char*)a, 0); }
+    static inline bool compareExchange(volatile unsigned char* a, unsigned char expected, unsigned char v) {
+        return _InterlockedCompareExchange8((volatile char*)a, (char)v, (char)expected) == (char)expected;
+    }
+    static inline void pause() { _mm_pause(); }
+    static inline void fence() { volatile long f = 0; _InterlockedExchange(&f, 0); }
+#else
+    static inline int load(volatile int* a) { return __atomic_load_n(a, __ATOMIC_SEQ_CST); }
+    static inline void store(volatile int* a, int v) { __atomic_store_n(a, v, __ATOMIC_SEQ_CST); }
+    static inline int add(volatile int* a, int v) { return __atomic_add_fetch(a, v, __ATOMIC_SEQ_CST); }
+    static inline int exchange(volatile int* a, int v) { return __atomic_exchange_n(a, v, __ATOMIC_SEQ_CST); }
+    static inline bool compareExchange(volatile int* a, int expected, int v) {
+        return __atomic_compare_exchange_n(a, &expected, v, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    }
+    static inline bool compareExchangePointer(void* volatile* a, void* expected, void* v) {
+        return __atomic_compare_exchange_n(a, &expected, v, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    }
+    static inline void* exchangePointer(void* volatile* a, void* v) { return __atomic_exchange_n(a, v, __ATOMIC_SEQ_CST); }
+    static inline long long load(volatile long long* a) { return __atomic_load_n(a, __ATOMIC_SEQ_CST); }
+    static inline long long add(volatile long long* a, long long v) { return __atomic_add_fetch(a, v, __ATOMIC_SEQ_CST); }
+    static inline void store(volatile long long* a, long long v) { __atomic_store_n(a, v, __ATOMIC_SEQ_CST); }
+    static inline bool compareExchange(volatile long long* a, long long expected, long long v) {
+        return __atomic_compare_exchange_n(a, &expected, v, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    }
+    static inline unsigned char load(volatile unsigned char* a) { return __atomic_load_n(a, __ATOMIC_SEQ_CST); }
+    static inline bool compareExchange(volatile unsigned char* a, unsigned char expected, unsigned char v) {
+        return __atomic_compare_exchange_n(a, &expected, v, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    }
+    static inline void pause() {
+#if defined(__i386__) || defined(__x86_64__)
+        __asm__ __volatile__("pause");
+#elif defined(__aarch64__) || defined(__arm__)
+        __asm__ __volatile__("yield");
+#endif
+    }
+    static inline void fence() { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+#endif
+private:
+    Atomic() { /* do not instantiate */ }
+};
+
+#endif /* __ATOMIC_H__ */
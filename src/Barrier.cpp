@@ -0,0 +1,119 @@
+/*  Copyright (c) 2013, Leo Kuznetsov
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "Barrier.h"
+#include "Futex.h"
+#include "Atomic.h"
+#include <assert.h>
+#include <string.h>
+
+#ifdef WIN32
+#pragma warning(disable: 4820 4514 4668 4711)
+#endif
+
+Barrier::Barrier(int threads, int spin_count) :
+    n(threads), spin(spin_count), count(threads), phase(0), sleepers(0) {
+    assert(threads > 0);
+}
+
+bool Barrier::enter() {
+    int p = Atomic::load(&phase);
+    if (Atomic::add(&count, -1) == 0) {
+        Atomic::store(&count, n); // nobody can arrive for the next phase before phase changes
+        Atomic::add(&phase, 1);
+        if (Atomic::load(&sleepers) > 0) {
+            Futex::wakeAll(&phase);
+        }
+        return true;
+    }
+    for (int i = 0; i < spin && Atomic::load(&phase) == p; i++) {
+        Atomic::pause();
+    }
+    while (Atomic::load(&phase) == p) {
+        Atomic::add(&sleepers, 1);
+        Futex::wait(&phase, p);
+        Atomic::add(&sleepers, -1);
+    }
+    return false;
+}
+
+enum { MAX_ROUNDS = 31, CACHE_LINE = 64 };
+
+struct DisseminationBarrier::Node {
+    volatile int flags[2][MAX_ROUNDS]; // [parity][round] written by the round's partner
+    volatile int sleeping;             // owner is (about to be) sleeping on one of the flags
+    int parity;                        // owner's private state
+    int sense;
+    char padding[CACHE_LINE];
+};
+
+DisseminationBarrier::DisseminationBarrier(int threads, int spin_count) :
+    n(threads), rounds(0), spin(spin_count), nodes(0) {
+    assert(threads > 0);
+    while ((1 << rounds) < n) {
+        rounds++;
+    }
+    nodes = new Node[n];
+    memset(nodes, 0, sizeof(Node) * n);
+    for (int i = 0; i < n; i++) {
+        nodes[i].sense = 1;
+    }
+}
+
+DisseminationBarrier::~DisseminationBarrier() {
+    delete[] nodes;
+    nodes = 0;
+}
+
+bool DisseminationBarrier::enter(int id) {
+    assert(0 <= id && id < n);
+    Node &self = nodes[id];
+    int parity = self.parity;
+    int sense = self.sense;
+    for (int r = 0; r < rounds; r++) {
+        Node &partner = nodes[(id + (1 << r)) % n];
+        Atomic::store(&partner.flags[parity][r], sense);
+        if (Atomic::load(&partner.sleeping) != 0) {
+            Futex::wake(&partner.flags[parity][r], 1);
+        }
+        volatile int* flag = &self.flags[parity][r];
+        for (int i = 0; i < spin && Atomic::load(flag) != sense; i++) {
+            Atomic::pause();
+        }
+        while (Atomic::load(flag) != sense) {
+            Atomic::store(&self.sleeping, 1);
+            Futex::wait(flag, !sense);
+            Atomic::store(&self.sleeping, 0);
+        }
+    }
+    if (parity == 1) {
+        self.sense = !sense;
+    }
+    self.parity = 1 - parity;
+    return id == 0;
+}
@@ -0,0 +1,137 @@
+/*  Copyright (c) 2013, Leo Kuznetsov
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "CompactEvent.h"
+#include "ParkingLot.h"
+#include "Event.h"
+#include "Atomic.h"
+#include "SystemTime.h"
+#include "Trace.h"
+
+#ifdef WIN32
+#pragma warning(disable: 4820 4514 4668 4711)
+#endif
+
+CompactEvent::CompactEvent(bool manual_reset, bool initial_state) :
+    state((unsigned char)((manual_reset ? MANUAL : 0) | (initial_state ? SIGNALED : 0))) {
+}
+
+/* WAITERS is set by a thread before it parks and cleared under the bucket lock when the
+   last parked thread is woken, so set() only touches the ParkingLot when someone sleeps.
+   Only set() unparks a manual-reset event: a thread unparked from it returns without
+   looking at the state again, so a reset() right after set() does not put it back to
+   sleep (every waiter parked at set() is released, as with Event) */
+
+CompactEvent& CompactEvent::set() {
+    TRACE(TRACE_SET, this);
+    for (;;) {
+        unsigned char s = Atomic::load(&state);
+        if (s & SIGNALED) {
+            return *this;
+        }
+        if ((s & WAITERS) == 0) {
+            if (Atomic::compareExchange(&state, s, (unsigned char)(s | SIGNALED))) {
+                return *this;
+            }
+        } else if (s & MANUAL) {
+            if (Atomic::compareExchange(&state, s, (unsigned char)((s | SIGNALED) & ~WAITERS))) {
+                ParkingLot::unparkAll(this);
+                return *this;
+            }
+        } else if (Atomic::compareExchange(&state, s, (unsigned char)(s | SIGNALED))) {
+            ParkingLot::unparkOne(this, unparked, this); // woken thread consumes the signal itself
+            return *this;
+        }
+    }
+}
+
+void CompactEvent::unparked(void* p, bool, bool has_more) { // under the bucket lock
+    CompactEvent* e = (CompactEvent*)p;
+    if (!has_more) {
+        for (;;) {
+            unsigned char s = Atomic::load(&e->state);
+            if (Atomic::compareExchange(&e->state, s, (unsigned char)(s & ~WAITERS))) {
+                break;
+            }
+        }
+    }
+}
+
+CompactEvent& CompactEvent::reset() {
+    TRACE(TRACE_RESET, this);
+    for (;;) {
+        unsigned char s = Atomic::load(&state);
+        if ((s & SIGNALED) == 0 || Atomic::compareExchange(&state, s, (unsigned char)(s & ~SIGNALED))) {
+            return *this;
+        }
+    }
+}
+
+bool CompactEvent::validate(void* p) { // under the bucket lock: still not signaled and marked
+    CompactEvent* e = (CompactEvent*)p;
+    return (Atomic::load(&e->state) & (SIGNALED | WAITERS)) == WAITERS;
+}
+
+int CompactEvent::wait(long long timeoutNanoseconds) {
+    long long deadline = timeoutNanoseconds < 0 ? 0 : SystemTime::mono() + timeoutNanoseconds;
+    bool blocked = false;
+    for (;;) {
+        unsigned char s = Atomic::load(&state);
+        if (s & SIGNALED) {
+            if ((s & MANUAL) || Atomic::compareExchange(&state, s, (unsigned char)(s & ~SIGNALED))) {
+                if (blocked) {
+                    TRACE(TRACE_WAKE, this);
+                }
+                return EVENT_WAIT_OBJECT_0;
+            }
+            continue;
+        }
+        long long timeout = -1;
+        if (timeoutNanoseconds >= 0) {
+            timeout = deadline - SystemTime::mono();
+            if (timeout <= 0) {
+                if (blocked) {
+                    TRACE(TRACE_TIMEOUT, this);
+                }
+                return EVENT_WAIT_TIMEOUT;
+            }
+        }
+        if ((s & WAITERS) == 0 && !Atomic::compareExchange(&state, s, (unsigned char)(s | WAITERS))) {
+            continue;
+        }
+        if (!blocked) {
+            TRACE(TRACE_WAIT_BEGIN, this);
+            blocked = true;
+        }
+        int r = ParkingLot::park(this, validate, this, timeout);
+        if (r == PARK_UNPARKED && (s & MANUAL)) {
+            TRACE(TRACE_WAKE, this);
+            return EVENT_WAIT_OBJECT_0;
+        }
+    }
+}
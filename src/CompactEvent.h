@@ -0,0 +1,54 @@
+/*  Copyright (c) 2013, Leo Kuznetsov
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+#ifndef __COMPACT_EVENT_H__
+#define __COMPACT_EVENT_H__
+
+/* Event in a single byte for very large numbers of per-object events: waiters sleep in the
+   global ParkingLot instead of per-event mutex and list. Same set/reset/wait semantics as
+   an unnamed Event (manual or auto-reset) but no waitAny/waitAll, options or alertable waits;
+   an uncontended set(), reset() or satisfied wait() is one atomic operation. */
+
+class CompactEvent {
+public:
+    CompactEvent(bool manual_reset = false, bool initial_state = false);
+    CompactEvent& set();
+    CompactEvent& reset();
+    /* returns EVENT_WAIT_OBJECT_0 or EVENT_WAIT_TIMEOUT; timeoutNanoseconds < 0 (EVENT_INFINITE) means infinite */
+    int wait(long long timeoutNanoseconds = -1);
+private:
+    enum { SIGNALED = 0x1, WAITERS = 0x2, MANUAL = 0x4 };
+    static bool validate(void* self);
+    static void unparked(void* self, bool unparked, bool has_more);
+    volatile unsigned char state;
+    CompactEvent(const CompactEvent&); // not copyable
+    CompactEvent& operator=(const CompactEvent&);
+};
+
+#endif /* __COMPACT_EVENT_H__ */
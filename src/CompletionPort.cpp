@@ -0,0 +1,310 @@
+/*  Copyright (c) 2013, Leo Kuznetsov
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "CompletionPort.h"
+#include "Thread.h"
+#include "Futex.h"
+#include "Atomic.h"
+#include "SystemTime.h"
+#include <assert.h>
+
+#define null NULL
+
+#ifdef WIN32
+#pragma warning(disable: 4820 4514 4668 4711)
+#include <Windows.h>
+
+static DWORD toMilliseconds(long long nanoseconds) {
+    return nanoseconds < 0 ? INFINITE : (DWORD)(nanoseconds / NANOSECONDS_IN_MILLISECOND);
+}
+
+CompletionPort::CompletionPort(int concurrency) :
+    port(CreateIoCompletionPort(INVALID_HANDLE_VALUE, null, 0, concurrency <= 0 ? 0 : (DWORD)concurrency)) {
+    assert(port != null);
+}
+
+CompletionPort::~CompletionPort() {
+    CloseHandle((HANDLE)port);
+}
+
+bool CompletionPort::post(void* key, void* overlapped, unsigned int bytes) {
+    return PostQueuedCompletionStatus((HANDLE)port, bytes, (ULONG_PTR)key, (LPOVERLAPPED)overlapped) != 0;
+}
+
+bool CompletionPort::get(Completion& c, long long timeoutNanoseconds) {
+    DWORD bytes = 0;
+    ULONG_PTR key = 0;
+    LPOVERLAPPED overlapped = null;
+    BOOL b = GetQueuedCompletionStatus((HANDLE)port, &bytes, &key, &overlapped, toMilliseconds(timeoutNanoseconds));
+    if (!b && overlapped == null) {
+        return false; // timeout: nothing dequeued
+    }
+    c.key = (void*)key;
+    c.overlapped = overlapped;
+    c.bytes = bytes;
+    return true;
+}
+
+int CompletionPort::getMany(Completion c[], int max, long long timeoutNanoseconds) {
+    OVERLAPPED_ENTRY entries[64];
+    ULONG n = 0;
+    ULONG m = max < 64 ? (ULONG)max : 64;
+    if (m == 0 || !GetQueuedCompletionStatusEx((HANDLE)port, entries, m, &n, toMilliseconds(timeoutNanoseconds), FALSE)) {
+        return 0;
+    }
+    for (ULONG i = 0; i < n; i++) {
+        c[i].key = (void*)entries[i].lpCompletionKey;
+        c[i].overlapped = entries[i].lpOverlapped;
+        c[i].bytes = entries[i].dwNumberOfBytesTransferred;
+    }
+    return (int)n;
+}
+
+#else
+#include <unistd.h>
+
+/* A worker "runs" from returning from get() with completions until its next get() and is
+   counted in running except while it is blocked (Thread::blockBegin..blockEnd). Completions
+   are handed to idle workers under the lock (the woken worker does not need to take it). */
+
+struct CompletionPort::Waiter { // lives on the stack of the idle worker
+    Completion* c;
+    int max;
+    int got;
+    Waiter* next;
+    volatile int state; // futex: HANDED | EXPIRED
+};
+
+enum { HANDED = 0x1, EXPIRED = 0x2 };
+
+struct Worker {
+    CompletionPort* port; // last port this thread called get() on
+    bool running;
+};
+
+static __thread Worker worker;
+
+CompletionPort::CompletionPort(int c) :
+    queue(new Completion[16]), capacity(16), first(0), count(0), idle(null),
+    concurrency(c > 0 ? c : (int)sysconf(_SC_NPROCESSORS_ONLN)), running(0) {
+    if (concurrency <= 0) {
+        concurrency = 1;
+    }
+}
+
+CompletionPort::~CompletionPort() {
+    assert(idle == null);
+    if (worker.port == this) {
+        worker.port = null;
+        worker.running = false;
+        Thread::setBlockHook(null, null);
+    }
+    delete[] queue;
+}
+
+void CompletionPort::release() {
+    if (worker.port == this && worker.running) {
+        running--;
+        worker.running = false;
+    }
+}
+
+int CompletionPort::take(Completion c[], int max) {
+    int n = max < count ? max : count;
+    for (int i = 0; i < n; i++) {
+        c[i] = queue[first];
+        first = (first + 1) & (capacity - 1);
+    }
+    count -= n;
+    return n;
+}
+
+CompletionPort::Waiter* CompletionPort::dispatch() {
+    Waiter* woken = null;
+    while (count > 0 && idle != null && running < concurrency) {
+        Waiter* w = idle; // most recently idle first
+        idle = w->next;
+        w->got = take(w->c, w->max);
+        running++;
+        w->next = woken;
+        woken = w;
+    }
+    return woken;
+}
+
+void CompletionPort::wake(Waiter* w) { // after lock is released: w is gone as soon as it sees HANDED
+    while (w != null) {
+        Waiter* next = w->next;
+        Atomic::add(&w->state, HANDED);
+        Futex::wake(&w->state, 1);
+        w = next;
+    }
+}
+
+void CompletionPort::blockHook(void* p, bool blocked) {
+    Worker* w = (Worker*)p;
+    if (!w->running) {
+        return;
+    }
+    CompletionPort* port = w->port;
+    Waiter* woken = null;
+    port->lock.acquireExclusive();
+    if (blocked) {
+        port->running--;
+        woken = port->dispatch();
+    } else {
+        port->running++; // may exceed concurrency until one of the running workers calls get()
+    }
+    port->lock.releaseExclusive();
+    wake(woken);
+}
+
+void CompletionPort::expired(void* p) {
+    Waiter* w = (Waiter*)p;
+    Atomic::add(&w->state, EXPIRED);
+    Futex::wake(&w->state, 1);
+}
+
+bool CompletionPort::post(void* key, void* overlapped, unsigned int bytes) {
+    lock.acquireExclusive();
+    if (count == capacity) {
+        Completion* q = new Completion[capacity * 2];
+        for (int i = 0; i < count; i++) {
+            q[i] = queue[(first + i) & (capacity - 1)];
+        }
+        delete[] queue;
+        queue = q;
+        capacity *= 2;
+        first = 0;
+    }
+    Completion& c = queue[(first + count) & (capacity - 1)];
+    c.key = key;
+    c.overlapped = overlapped;
+    c.bytes = bytes;
+    count++;
+    Waiter* woken = dispatch();
+    lock.releaseExclusive();
+    wake(woken);
+    return true;
+}
+
+bool CompletionPort::get(Completion& c, long long timeoutNanoseconds) {
+    return getMany(&c, 1, timeoutNanoseconds) == 1;
+}
+
+int CompletionPort::getMany(Completion c[], int max, long long timeoutNanoseconds) {
+    assert(max > 0);
+    Worker& w = worker;
+    if (w.port != this) {
+        CompletionPort* previous = w.port;
+        if (previous != null) {
+            previous->lock.acquireExclusive();
+            previous->release();
+            Waiter* woken = previous->dispatch();
+            previous->lock.releaseExclusive();
+            wake(woken);
+        }
+        w.port = this;
+        w.running = false;
+        Thread::setBlockHook(blockHook, &w);
+    }
+    lock.acquireExclusive();
+    release();
+    int n = 0;
+    if (count > 0 && running < concurrency) {
+        n = take(c, max); // the calling worker is the most recently idle one
+        running++;
+        w.running = true;
+    }
+    Waiter* woken = dispatch();
+    if (n > 0 || timeoutNanoseconds == 0) {
+        lock.releaseExclusive();
+        wake(woken);
+        return n;
+    }
+    Waiter self;
+    self.c = c;
+    self.max = max;
+    self.got = 0;
+    self.next = idle;
+    self.state = 0;
+    idle = &self;
+    lock.releaseExclusive();
+    wake(woken);
+    long long deadline = timeoutNanoseconds < 0 ? -1 : SystemTime::mono() + timeoutNanoseconds;
+    bool virtual_time = deadline >= 0 && SystemTime::isVirtual();
+    SystemTime::Timer timer = { deadline, expired, &self, null };
+    if (virtual_time) {
+        SystemTime::addTimer(&timer);
+    }
+    Thread::blockBegin(); // w.running is false: does not count as blocked worker
+    for (;;) {
+        int s = Atomic::load(&self.state);
+        if (s & HANDED) {
+            break;
+        }
+        long long timeout = -1;
+        if (deadline >= 0) {
+            long long now = SystemTime::mono();
+            if ((s & EXPIRED) || now >= deadline) {
+                bool queued = false;
+                lock.acquireExclusive();
+                Waiter* prev = null;
+                for (Waiter* q = idle; q != null; prev = q, q = q->next) {
+                    if (q == &self) {
+                        if (prev != null) { prev->next = q->next; } else { idle = q->next; }
+                        queued = true;
+                        break;
+                    }
+                }
+                lock.releaseExclusive();
+                if (queued) {
+                    break;
+                }
+                while ((Atomic::load(&self.state) & HANDED) == 0) { // being handed right now
+                    Futex::wait(&self.state, Atomic::load(&self.state) & ~HANDED);
+                }
+                break;
+            }
+            if (!virtual_time) {
+                timeout = deadline - now;
+            }
+        }
+        Futex::wait(&self.state, s, timeout);
+    }
+    Thread::blockEnd();
+    if (virtual_time) {
+        SystemTime::removeTimer(&timer); // waits for expired() to return
+    }
+    if (self.got > 0) {
+        w.running = true; // counted in running by dispatch()
+    }
+    return self.got;
+}
+
+#endif
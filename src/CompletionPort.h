@@ -0,0 +1,85 @@
+/*  Copyright (c) 2013, Leo Kuznetsov
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+#ifndef __COMPLETION_PORT_H__
+#define __COMPLETION_PORT_H__
+
+#include "SRWLock.h"
+
+/* OVERLAPPED_ENTRY of a posted completion: meaning of all three fields is up to the caller */
+struct Completion {
+    void* key;
+    void* overlapped;
+    unsigned int bytes;
+};
+
+/* I/O completion port without file handles (CreateIoCompletionPort/PostQueuedCompletionStatus/
+   GetQueuedCompletionStatus): completions are taken in FIFO order, the most recently idle
+   worker is woken first (LIFO keeps few threads hot) and at most "concurrency" workers that
+   returned from get() run at the same time. A worker blocked in Event or CompactEvent waits
+   or join() (see Thread::blockBegin) does not count until it wakes up, so another worker can
+   run meanwhile. A thread belongs to the last port it called get() on until it exits: delete
+   a port only after its other workers have exited or moved on.
+   Win32: native I/O completion port. */
+
+class CompletionPort {
+public:
+    /* concurrency <= 0 means number of processors */
+    CompletionPort(int concurrency = 0);
+    virtual ~CompletionPort();
+    bool post(void* key, void* overlapped = 0, unsigned int bytes = 0);
+    /* returns false on timeout, timeoutNanoseconds < 0 (EVENT_INFINITE) means infinite */
+    bool get(Completion& c, long long timeoutNanoseconds = -1);
+    /* GetQueuedCompletionStatusEx: takes up to max completions at once, returns 0 on timeout */
+    int getMany(Completion c[], int max, long long timeoutNanoseconds = -1);
+private:
+#ifdef WIN32
+    void* port;
+#else
+    struct Waiter;
+    static void blockHook(void* worker, bool blocked);
+    static void expired(void* waiter);
+    void release();        /* calling worker stops running: under lock */
+    int take(Completion c[], int max); /* under lock */
+    Waiter* dispatch();    /* under lock: hands queued completions to idle workers */
+    static void wake(Waiter* list);
+    SRWLock lock;
+    Completion* queue;     /* ring buffer */
+    int capacity;
+    int first;
+    int count;
+    Waiter* idle;          /* LIFO */
+    int concurrency;
+    int running;
+#endif
+    CompletionPort(const CompletionPort&); // not copyable
+    CompletionPort& operator=(const CompletionPort&);
+};
+
+#endif /* __COMPLETION_PORT_H__ */
@@ -0,0 +1,93 @@
+/*  Copyright (c) 2013, Leo Kuznetsov
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "ConditionVariable.h"
+#include "SystemTime.h"
+#include "Futex.h"
+#include <errno.h>
+
+#ifdef WIN32
+#pragma warning(disable: 4820 4514 4668 4711)
+#include <Windows.h>
+
+ConditionVariable::ConditionVariable() {
+    ::InitializeConditionVariable((PCONDITION_VARIABLE)&cv);
+}
+
+bool ConditionVariable::sleep(SRWLock& lock, long long timeoutNanoseconds, bool shared) {
+    DWORD ms = timeoutNanoseconds < 0 ? INFINITE : (DWORD)(timeoutNanoseconds / NANOSECONDS_IN_MILLISECOND);
+    ULONG flags = shared ? CONDITION_VARIABLE_LOCKMODE_SHARED : 0;
+    return ::SleepConditionVariableSRW((PCONDITION_VARIABLE)&cv, (PSRWLOCK)&lock.lock, ms, flags) != 0;
+}
+
+void ConditionVariable::wake() {
+    ::WakeConditionVariable((PCONDITION_VARIABLE)&cv);
+}
+
+void ConditionVariable::wakeAll() {
+    ::WakeAllConditionVariable((PCONDITION_VARIABLE)&cv);
+}
+
+#else
+
+ConditionVariable::ConditionVariable() : seq(0), waiters(0) {
+}
+
+bool ConditionVariable::sleep(SRWLock& lock, long long timeoutNanoseconds, bool shared) {
+    __atomic_add_fetch(&waiters, 1, __ATOMIC_SEQ_CST);
+    int q = __atomic_load_n(&seq, __ATOMIC_SEQ_CST); // sampled under the lock: no wake() is lost
+    if (shared) {
+        lock.releaseShared();
+    } else {
+        lock.releaseExclusive();
+    }
+    int r = Futex::wait(&seq, q, timeoutNanoseconds);
+    __atomic_sub_fetch(&waiters, 1, __ATOMIC_SEQ_CST);
+    if (shared) {
+        lock.acquireShared();
+    } else {
+        lock.acquireExclusive();
+    }
+    return r != ETIMEDOUT;
+}
+
+void ConditionVariable::wake() {
+    __atomic_add_fetch(&seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&waiters, __ATOMIC_SEQ_CST) > 0) {
+        Futex::wake(&seq, 1);
+    }
+}
+
+void ConditionVariable::wakeAll() {
+    __atomic_add_fetch(&seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&waiters, __ATOMIC_SEQ_CST) > 0) {
+        Futex::wakeAll(&seq);
+    }
+}
+
+#endif
@@ -0,0 +1,59 @@
+/*  Copyright (c) 2013, Leo Kuznetsov
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+#ifndef __CONDITION_VARIABLE_H__
+#define __CONDITION_VARIABLE_H__
+
+#include "SRWLock.h"
+
+/* Win32 CONDITION_VARIABLE used with SRWLock (SleepConditionVariableSRW).
+   wake() and wakeAll() do not enter the kernel when nobody sleeps: an atomic add of the
+   sequence and a load of the waiters count.
+   As on Win32 sleep() may return spuriously: callers re-check their predicate in a loop. */
+
+class ConditionVariable {
+public:
+    ConditionVariable();
+    /* atomically releases the lock, sleeps and reacquires the lock in the same mode;
+       returns false on timeout; timeoutNanoseconds < 0 (EVENT_INFINITE) means infinite */
+    bool sleep(SRWLock& lock, long long timeoutNanoseconds = -1, bool shared = false);
+    void wake();
+    void wakeAll();
+private:
+#ifdef WIN32
+    void* cv; // CONDITION_VARIABLE
+#else
+    volatile int seq;     // futex: incremented by wake() and wakeAll()
+    volatile int waiters;
+#endif
+    ConditionVariable(const ConditionVariable&); // not copyable
+    ConditionVariable& operator=(const ConditionVariable&);
+};
+
+#endif /* __CONDITION_VARIABLE_H__ */
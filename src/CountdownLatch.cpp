@@ -0,0 +1,74 @@
+/*  Copyright (c) 2013, Leo Kuznetsov
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "CountdownLatch.h"
+#include "SystemTime.h"
+#include "Futex.h"
+#include "Atomic.h"
+#include <assert.h>
+#include <errno.h>
+
+#ifdef WIN32
+#pragma warning(disable: 4820 4514 4668 4711)
+#endif
+
+CountdownLatch::CountdownLatch(int count) : counter(count), sleepers(0) {
+    assert(count >= 0);
+}
+
+void CountdownLatch::countDown(int n) {
+    int c = Atomic::add(&counter, -n);
+    assert(c >= 0); // counted down more times than constructed with
+    if (c == 0 && Atomic::load(&sleepers) > 0) {
+        Futex::wakeAll(&counter);
+    }
+}
+
+bool CountdownLatch::wait(long long timeoutNanoseconds) {
+    long long deadline = timeoutNanoseconds < 0 ? 0 : SystemTime::realMono() + timeoutNanoseconds;
+    for (;;) {
+        int c = Atomic::load(&counter);
+        if (c <= 0) {
+            return true;
+        }
+        long long timeout = -1;
+        if (timeoutNanoseconds >= 0) {
+            timeout = deadline - SystemTime::realMono();
+            if (timeout <= 0) {
+                return false;
+            }
+        }
+        Atomic::add(&sleepers, 1);
+        Futex::wait(&counter, c, timeout);
+        Atomic::add(&sleepers, -1);
+    }
+}
+
+int CountdownLatch::count() {
+    return Atomic::load(&counter);
+}
@@ -28,6 +28,11 @@
  */
 #include "Event.h"
 #include "SystemTime.h"
+#include "Futex.h"
+#include "Atomic.h"
+#include "FiberScheduler.h"
+#include "Thread.h"
+#include "Trace.h"
 #include <assert.h>
 #include <stdarg.h>
 #include <string.h>
@@ -50,30 +55,59 @@ Event::Event(bool manual_reset, bool initial_state) {
     assert(handle != null);
 }
 
-Event::~Event() {
+Event::Event(const char* name, bool manual_reset, bool initial_state) {
+    handle = ::CreateEventA(null, manual_reset, initial_state, name); // null: see isValid()
+}
+
+Event::Event(bool manual_reset, bool initial_state, int) {
+    handle = ::CreateEventA(null, manual_reset, initial_state, null);
     #pragma warning(suppress: 4365)
     assert(handle != null);
-    ::CloseHandle(handle);
+}
+
+Event::~Event() {
+    if (handle != null) {
+        ::CloseHandle(handle);
+    }
+}
+
+bool Event::isValid() {
+    return handle != null;
 }
 
 Event& Event::set() {
+    TRACE(TRACE_SET, this);
     ::SetEvent(handle);
     return *this;
 }
 
 Event& Event::reset() {
+    TRACE(TRACE_RESET, this);
     ::ResetEvent(handle);
     return *this;
 }
 
 int Event::wait(long long timeoutNanoseconds) {
-    return (int)::WaitForSingleObjectEx(handle, milliseconds(timeoutNanoseconds), true);
+    return waitEx(timeoutNanoseconds, false);
+}
+
+int Event::waitEx(long long timeoutNanoseconds, bool alertable) {
+    TRACE(TRACE_WAIT_BEGIN, this);
+    Thread::blockBegin(); // also counts waits satisfied at once: Win32 does not tell
+    int r = (int)::WaitForSingleObjectEx(handle, milliseconds(timeoutNanoseconds), alertable);
+    Thread::blockEnd();
+    TRACE(r == WAIT_TIMEOUT ? TRACE_TIMEOUT : TRACE_WAKE, this);
+    return r;
 }
 
 int Event::wait() {
     return wait(EVENT_INFINITE);
 }
 
+long long Event::worstWakeLatency() {
+    return -1;
+}
+
 int Event::wait(long long timeoutNanoseconds, bool wait_all, int n, ...) {
     va_list ap;
     va_start(ap, n);
@@ -86,46 +120,253 @@ int Event::wait(long long timeoutNanoseconds, bool wait_all, int n, ...) {
 }
 
 int Event::wait(long long timeoutNanoseconds, bool wait_all, int n, Event* e[]) {
+    return waitEx(timeoutNanoseconds, wait_all, false, n, e);
+}
+
+int Event::waitEx(long long timeoutNanoseconds, bool wait_all, bool alertable, int n, Event* e[]) {
     HANDLE* handles = (HANDLE*)_alloca(n * sizeof(HANDLE));
     for (int i = 0; i < n; i++) {
         handles[i] = e[i]->handle;
     }
-    return (int)::WaitForMultipleObjects((DWORD)n, handles, wait_all, milliseconds(timeoutNanoseconds));
+    TRACE(TRACE_WAIT_BEGIN, e[0]);
+    Thread::blockBegin();
+    int r = (int)::WaitForMultipleObjectsEx((DWORD)n, handles, wait_all, milliseconds(timeoutNanoseconds), alertable);
+    Thread::blockEnd();
+    TRACE(r == WAIT_TIMEOUT ? TRACE_TIMEOUT : TRACE_WAKE, e[WAIT_OBJECT_0 < r && r < WAIT_OBJECT_0 + n ? r - WAIT_OBJECT_0 : 0]);
+    return r;
+}
+
+int Event::waitAnyOrMessage(long long timeoutNanoseconds, int n, Event* e[]) {
+    HANDLE* handles = (HANDLE*)_alloca((n + 1) * sizeof(HANDLE));
+    for (int i = 0; i < n; i++) {
+        handles[i] = e[i]->handle;
+    }
+    Thread::blockBegin();
+    int r = (int)::MsgWaitForMultipleObjectsEx((DWORD)n, handles, milliseconds(timeoutNanoseconds),
+                                               QS_ALLPOSTMESSAGE, MWMO_INPUTAVAILABLE);
+    Thread::blockEnd();
+    return r;
 }
 
 #else
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <signal.h>
+
 pthread_condattr_t* clock_monotonic = null;
 pthread_condattr_t  clock_monotonic_imp;
 
-struct Event::Blocked { // node for blocked thread waiting on an event
+struct Event::Blocked { // blocked thread waiting on events
     pthread_mutex_t mutex_signaled;
     pthread_cond_t  signal;
     int n;
-    bool* signaled;
+    bool wait_all;
+    int satisfied;      // !wait_all: index of the event that set() handed (and consumed) to the waiter
+    bool* signaled;     // wait_all: events seen signaled since the waiter last checked
     Event** events;
-    struct Blocked *prev, *next;
+    Link* links;        // links[i] is the node in events[i] list
+    Event* woken_by;    // realtime event that signaled the waiter
+    long long set_time; // and SystemTime::realMono() when it did
+    Fiber* fiber;       // waiter is a scheduled fiber: woken with FiberScheduler::ready()
+    int alert;          // index of the waiting thread's APC event in events[] or -1
+    int setter;         // EVENT_TRACE: trace thread id of the last set() that woke the waiter
+    long long set_ticks; // and its Trace::ticks()
+};
+
+struct Event::Link {
+    Blocked* blocked;
+    int priority; // scheduling priority of the waiting thread (realtime events only)
+    Link *prev, *next;
+};
+
+/* EVENT_REALTIME: the event mutex and the waiter's mutex_signaled are priority inheritance
+   mutexes and waiters are queued by priority, so set() signals the highest priority waiter
+   first. The waiter itself sleeps on a plain pthread_cond (glibc does not requeue condition
+   variable waiters onto PI futexes): between pthread_cond_signal() and the waiter owning
+   mutex_signaled again nothing is boosted, and a low priority setter preempted by medium
+   priority threads right after signaling still delays a high priority waiter. Only the
+   time spent holding the locks is covered by inheritance. */
+
+#if defined(_POSIX_THREAD_PRIO_INHERIT) && _POSIX_THREAD_PRIO_INHERIT > 0
+#define PRIO_INHERIT_MUTEX
+#endif
+
+static void priorityInheritMutexInit(pthread_mutex_t* m) {
+    pthread_mutexattr_t a;
+    pthread_mutexattr_init(&a);
+#ifdef PRIO_INHERIT_MUTEX
+    pthread_mutexattr_setprotocol(&a, PTHREAD_PRIO_INHERIT);
+#endif
+    pthread_mutex_init(m, &a);
+    pthread_mutexattr_destroy(&a);
+}
+
+static int schedulingPriority() {
+    int policy = SCHED_OTHER;
+    struct sched_param sp;
+    memset(&sp, 0, sizeof(sp));
+    pthread_getschedparam(pthread_self(), &policy, &sp);
+    return policy == SCHED_FIFO || policy == SCHED_RR ? sp.sched_priority : 0;
+}
+
+/* Named events live in a single POSIX shared memory segment (NAMED_EVENTS_SHM) mapped by all
+   processes. Robust process-shared mutexes guard each event, so a process crashing while holding
+   one does not leave the event locked forever. Waiters on a single event sleep on its seq futex,
+   waiters on several events sleep on the table wide epoch futex which set() bumps only when such
+   waiters exist. Every process attached to the table has an entry there; references and waiter
+   counts are kept per entry so the ones of a process that died are dropped (reap()) and its
+   events reclaimed by the next process that locks the table. A process detaches when it closes
+   its last named event; the last one to detach unlinks the segment. Liveness is kill(pid, 0):
+   a recycled pid keeps a dead process's references until that process exits too. */
+
+#define NAMED_EVENTS_SHM "/win32posix.events"
+
+enum {
+    NAMED_EVENTS_MAX = 256,
+    NAMED_EVENT_NAME_MAX = 64,
+    NAMED_PROCESSES_MAX = 32, // processes with named events open at the same time
+    NAMED_EVENTS_MAGIC = 0x45565432 // "EVT2" bump on layout changes
 };
 
-Event::Event(bool manual_reset, bool initial_state) :
-    start(null), end(null), manual(manual_reset), signaled(initial_state) {
-    pthread_mutex_init(&mutex, null);
+#if defined(__linux__) && !defined(__ANDROID__)
+#define ROBUST_MUTEX
+#endif
+
+struct Event::Named {
+    pthread_mutex_t mutex;
+    char name[NAMED_EVENT_NAME_MAX]; // empty: free slot
+    int refs[NAMED_PROCESSES_MAX];   // opened by the process with this entry in the table
+    volatile int waiters[NAMED_PROCESSES_MAX]; // per process: single event waiters sleeping on seq
+    volatile int seq;     // futex: incremented by each set()
+    bool manual;
+    bool signaled;
+};
+
+struct Event::NamedTable {
+    volatile int magic;    // set last by the process that created the segment
+    volatile int epoch;    // futex: incremented by set() when waiters != 0
+    volatile int unlinked; // set by the last process to detach before shm_unlink()
+    pthread_mutex_t mutex; // guards processes, name and refs of all events
+    pid_t processes[NAMED_PROCESSES_MAX]; // attached processes, 0: free entry
+    volatile int waiters[NAMED_PROCESSES_MAX]; // per process: multiple events waiters sleeping on epoch
+    Named events[NAMED_EVENTS_MAX];
+};
+
+Event::Event(bool manual_reset, bool initial_state) {
+    init(manual_reset, initial_state, 0);
+}
+
+Event::Event(const char* name, bool manual_reset, bool initial_state) {
+    init(manual_reset, initial_state, 0);
+    named = openNamed(name, manual_reset, initial_state);
+    failed = named == null;
+}
+
+Event::Event(bool manual_reset, bool initial_state, int options) {
+    init(manual_reset, initial_state, options);
+}
+
+void Event::init(bool manual_reset, bool initial_state, int options) {
+    named = null;
+    failed = false;
+    start = end = null;
+    manual = manual_reset;
+    signaled = initial_state;
+    realtime = (options & EVENT_REALTIME) != 0;
+    worst_latency = realtime ? 0 : -1;
+    generation = 0;
+    waiting = 0;
+    released = 0;
+    waking = 0;
+    setter = 0;
+    set_ticks = 0;
+    if (realtime) {
+        priorityInheritMutexInit(&mutex);
+    } else {
+        pthread_mutex_init(&mutex, null);
+    }
 }
 
 Event::~Event() {
-    assert(start == null && end == null); // nobody still waiting on it
+    assert(start == null && end == null && waiting == 0 && released == 0); // nobody still waiting on it
+    while (Atomic::load(&waking) != 0) { // a waiter may return before set() has woken the others
+        Atomic::pause();
+    }
+    if (named != null) {
+        closeNamed(named);
+    }
     pthread_mutex_destroy(&mutex);
 }
 
+bool Event::isValid() {
+    return !failed;
+}
+
 Event& Event::set() {
+    TRACE(TRACE_SET, this);
+    if (failed) {
+        return *this;
+    }
+    if (named != null) {
+        NamedTable* t = namedTable();
+        Event* e = this;
+        lockNamed(1, &e);
+        named->signaled = true;
+        __atomic_add_fetch(&named->seq, 1, __ATOMIC_SEQ_CST);
+        bool waiters = false;
+        for (int i = 0; i < NAMED_PROCESSES_MAX && !waiters; i++) { waiters = named->waiters[i] > 0; }
+        bool manual_reset = named->manual;
+        unlockNamed(1, &e);
+        if (waiters) {
+            Futex::wake(&named->seq, manual_reset ? 0x7FFFFFFF : 1, true);
+        }
+        bool multiple = false;
+        for (int i = 0; i < NAMED_PROCESSES_MAX && !multiple; i++) {
+            multiple = __atomic_load_n(&t->waiters[i], __ATOMIC_SEQ_CST) > 0;
+        }
+        if (multiple) {
+            __atomic_add_fetch(&t->epoch, 1, __ATOMIC_SEQ_CST);
+            Futex::wakeAll(&t->epoch, true);
+        }
+        return *this;
+    }
     pthread_mutex_lock(&mutex);
     signaled = true;
+    bool wake = waiting > 0; // manual-reset only
+    if (wake) {
+#ifdef EVENT_TRACE
+        setter = Trace::thread();
+        set_ticks = Trace::ticks();
+#endif
+        Atomic::add(&waking, 1); // before generation: released waiters see it
+        Atomic::add(&released, waiting);
+        waiting = 0;
+        Atomic::add(&generation, 1);
+    }
     notifyAll();
     pthread_mutex_unlock(&mutex);
+    if (wake) { // one wake whatever the number of sleepers: they wake each other
+        Futex::wake(&generation, 1);
+        Atomic::add(&waking, -1); // last access: the event may be destroyed from here on
+    }
     return *this;
 }
 
 Event& Event::reset() {
+    TRACE(TRACE_RESET, this);
+    if (failed) {
+        return *this;
+    }
+    if (named != null) {
+        Event* e = this;
+        lockNamed(1, &e);
+        named->signaled = false;
+        unlockNamed(1, &e);
+        return *this;
+    }
     pthread_mutex_lock(&mutex);
     signaled = false;
     pthread_mutex_unlock(&mutex);
@@ -136,10 +377,22 @@ int Event::wait(long long timeoutNanoseconds) {
     return wait(timeoutNanoseconds, false, 1, this);
 }
 
+int Event::waitEx(long long timeoutNanoseconds, bool alertable) {
+    Event* e = this;
+    return waitEx(timeoutNanoseconds, false, alertable, 1, &e);
+}
+
 int Event::wait() {
     return wait(EVENT_INFINITE);
 }
 
+long long Event::worstWakeLatency() {
+    pthread_mutex_lock(&mutex);
+    long long r = worst_latency;
+    pthread_mutex_unlock(&mutex);
+    return r;
+}
+
 int Event::wait(long long timeoutNanoseconds, bool wait_all, int n, ...) {
     va_list ap;
     va_start(ap, n);
@@ -151,70 +404,171 @@ int Event::wait(long long timeoutNanoseconds, bool wait_all, int n, ...) {
     return wait(timeoutNanoseconds, wait_all, n, e);
 }
 
+/* waitAny waiters are handed the signal (auto-reset events are consumed right here),
+   waitAll waiters are only notified and consume all events themselves once they hold
+   all the locks, so an auto-reset event stays signaled for others until then */
+
 void Event::notifyAll() {
-    Blocked* p = start;
-    while (p != null && signaled) {
-        pthread_mutex_lock(&p->mutex_signaled);
-        markSignaled(*p, this);
-        pthread_cond_signal(&p->signal);
-        pthread_mutex_unlock(&p->mutex_signaled);
-        if (!manual) {
-            signaled = false;
+    long long now = realtime ? SystemTime::realMono() : 0;
+#ifdef EVENT_TRACE
+    int setter = start != null ? Trace::thread() : 0;
+    long long set_ticks = start != null ? Trace::ticks() : 0;
+#endif
+    for (Link* p = start; p != null && signaled; p = p->next) {
+        Blocked* b = p->blocked;
+        pthread_mutex_lock(&b->mutex_signaled);
+        int i = markSignaled(*b, this);
+        bool wake = b->wait_all || b->satisfied < 0;
+        if (!b->wait_all && b->satisfied < 0) {
+            b->satisfied = i;
+            if (!manual) {
+                signaled = false;
+            }
+        }
+        if (wake) {
+            if (realtime) {
+                b->woken_by = this;
+                b->set_time = now;
+            }
+#ifdef EVENT_TRACE
+            b->setter = setter;
+            b->set_ticks = set_ticks;
+#endif
+            if (b->fiber != null) {
+                FiberScheduler::ready(b->fiber);
+            } else {
+                pthread_cond_signal(&b->signal);
+            }
         }
-        p = p == end ? null : p->next;
+        pthread_mutex_unlock(&b->mutex_signaled);
     }
 }
 
-void Event::insert(Blocked* b) {
-    if (start == null) {
-        start = end = b;
-    } else {
-        end->next = b;
-        b->next = end;
-        end = b;
+/* Plain single event waits on manual-reset events do not queue a Blocked node: they sleep
+   on the event's generation futex. set() bumps it, adds the sleepers of the old generation
+   to "released" and wakes exactly one of them: every released sleeper on its way out wakes
+   the next one while "released" says some are still asleep. The setter does O(1) work
+   whatever the number of waiters (the wake-up of all of them is spread along the chain) and
+   a released waiter does not need the event mutex to return. A sleeper that arrived after a
+   reset() can take a chain wake (futex queues are FIFO for equal priorities so normally
+   the older released sleepers get it first): it passes the wake on and sleeps again. A
+   waiter is released by any set() after it started waiting even if reset() follows before
+   it runs (generation differs from the one it sampled), same as with notifyAll(); a waiter
+   arriving later samples the new generation and is not. Realtime events (priority order,
+   latency), fibers and virtual clock timeouts still need Blocked */
+
+int Event::waitBroadcast(long long timeoutNanoseconds) {
+    pthread_mutex_lock(&mutex);
+    if (signaled || timeoutNanoseconds == 0) {
+        int r = signaled ? EVENT_WAIT_OBJECT_0 : EVENT_WAIT_TIMEOUT;
+        pthread_mutex_unlock(&mutex);
+        return r;
+    }
+    int g = generation;
+    waiting++;
+    pthread_mutex_unlock(&mutex);
+    TRACE(TRACE_WAIT_BEGIN, this);
+    int r = EVENT_WAIT_OBJECT_0;
+    long long deadline = timeoutNanoseconds == EVENT_INFINITE ? -1 : SystemTime::mono() + timeoutNanoseconds;
+    Thread::blockBegin();
+    while (Atomic::load(&generation) == g) {
+        long long timeout = -1;
+        if (deadline >= 0) {
+            timeout = deadline - SystemTime::mono();
+            if (timeout <= 0) {
+                r = EVENT_WAIT_TIMEOUT;
+                break;
+            }
+        }
+        Futex::wait(&generation, g, timeout);
+        if (Atomic::load(&generation) == g && Atomic::load(&released) > 0) {
+            Futex::wake(&generation, 1); // took a chain wake meant for a released sleeper
+        }
+    }
+    Thread::blockEnd();
+    bool done = Atomic::load(&generation) != g;
+    if (!done) { // timed out unless set() is releasing it right now
+        pthread_mutex_lock(&mutex);
+        done = generation != g;
+        if (!done) { waiting--; }
+        pthread_mutex_unlock(&mutex);
+    }
+#ifdef EVENT_TRACE
+    int by = setter;
+    long long ticks = set_ticks;
+#endif
+    if (done) {
+        r = EVENT_WAIT_OBJECT_0;
+        if (Atomic::add(&released, -1) > 0) { // last access but the wake below
+            Futex::wake(&generation, 1); // next one in the chain
+        }
+    }
+    TRACE(r == EVENT_WAIT_TIMEOUT ? TRACE_TIMEOUT : TRACE_WAKE, this);
+#ifdef EVENT_TRACE
+    if (r == EVENT_WAIT_OBJECT_0 && by != 0) {
+        TRACE_WOKEN_BY(by, ticks);
     }
+#endif
+    return r;
 }
 
-void Event::remove(Blocked* b) {
-    if (start == end) {
-        start = end = NULL;
-    } else if (b == start) {
-        start = start->next;
-    } else if (b == end) {
-        end = end->next;
-    } else {
-        Blocked* ptr = start->next;
-        while (ptr != b) {
-            ptr = ptr->next;
+void Event::insert(Link* l) {
+    Link* p = end; // insert after p
+    while (realtime && p != null && p->priority < l->priority) {
+        p = p->prev;
+    }
+    l->prev = p;
+    l->next = p == null ? start : p->next;
+    if (l->prev != null) { l->prev->next = l; } else { start = l; }
+    if (l->next != null) { l->next->prev = l; } else { end = l; }
+}
+
+void Event::remove(Link* l) {
+    if (l->prev != null) { l->prev->next = l->next; } else { start = l->next; }
+    if (l->next != null) { l->next->prev = l->prev; } else { end = l->prev; }
+    l->prev = l->next = null;
+}
+
+/* Events are always locked in the same global order (by address of the local
+   or shared state) so waitAll(a, b) and waitAll(b, a) cannot deadlock */
+
+void Event::order(int n, Event* e[], Event* sorted[]) {
+    for (int i = 0; i < n; i++) { // insertion sort: n is small
+        Event* x = e[i];
+        const void* key = x->named != null ? (const void*)x->named : (const void*)x;
+        int j = i;
+        while (j > 0 && key < (sorted[j - 1]->named != null ? (const void*)sorted[j - 1]->named : (const void*)sorted[j - 1])) {
+            sorted[j] = sorted[j - 1];
+            j--;
         }
-        assert(ptr == b);
-        ptr->prev->next = ptr->next;
-        ptr->next->prev = ptr->prev;
+        sorted[j] = x;
     }
 }
 
-void Event::lock(int n, Event* e[]) {
-    for (int i = 0; i < n; i++) { pthread_mutex_lock(&e[i]->mutex); }
+void Event::lock(int n, Event* sorted[]) {
+    for (int i = 0; i < n; i++) { pthread_mutex_lock(&sorted[i]->mutex); }
 }
 
-void Event::unlock(int n, Event* e[]) {
-    for (int i = 0; i < n; i++) { pthread_mutex_unlock(&e[i]->mutex); }
+void Event::unlock(int n, Event* sorted[]) {
+    for (int i = n - 1; i >= 0; i--) { pthread_mutex_unlock(&sorted[i]->mutex); }
 }
 
-void Event::markSignaled(Blocked &b, Event* e) {
+int Event::markSignaled(Blocked &b, Event* e) {
     for (int i = 0; i < b.n; i++) {
         if (b.events[i] == e) {
             b.signaled[i] = e->signaled;
-            break;
+            return i;
         }
     }
+    assert(false);
+    return -1;
 }
 
 int Event::checkSignaled(Blocked &b, bool &all) {
     int first = -1;
     all = true;
     for (int i = 0; i < b.n; i++) {
-        all = all && b.signaled[i];
+        all = all && (b.signaled[i] || i == b.alert);
         if (b.signaled[i]) {
             if (first < 0) {
                 first = i;
@@ -224,6 +578,33 @@ int Event::checkSignaled(Blocked &b, bool &all) {
     return first;
 }
 
+bool Event::isSatisfied(Blocked &b) { // under b.mutex_signaled
+    bool all = false;
+    checkSignaled(b, all);
+    return b.wait_all ? all || (b.alert >= 0 && b.signaled[b.alert]) : b.satisfied >= 0;
+}
+
+int Event::acquire(Blocked &b) { // under all b.events locks: consume the events if the wait is satisfied
+    for (int i = 0; i < b.n; i++) {
+        b.signaled[i] = b.events[i]->signaled;
+    }
+    if (b.alert >= 0 && b.signaled[b.alert]) { // queued APCs take precedence as on Win32
+        b.events[b.alert]->signaled = false;
+        return EVENT_WAIT_IO_COMPLETION;
+    }
+    bool all = false;
+    int first = checkSignaled(b, all);
+    if (b.wait_all ? !all : first < 0) {
+        return -1;
+    }
+    for (int i = b.wait_all ? 0 : first; i < (b.wait_all ? b.n : first + 1); i++) {
+        if (i != b.alert && !b.events[i]->manual) {
+            b.events[i]->signaled = false;
+        }
+    }
+    return b.wait_all ? EVENT_WAIT_OBJECT_0 : EVENT_WAIT_OBJECT_0 + first;
+}
+
 bool Event::checkDuplicates(Blocked &b) {
     for (int i = 0; i < b.n; i++) {
         for (int j = i + 1; j < b.n; j++) {
@@ -243,32 +624,128 @@ static timedwait_f monotonic_cond_timedwait = pthread_cond_timedwait_monotonic;
 static timedwait_f monotonic_cond_timedwait = pthread_cond_timedwait;
 #endif
 
+void Event::virtualTimeout(void* p) { // under SystemTime timers lock
+    Blocked* b = (Blocked*)p;
+    pthread_mutex_lock(&b->mutex_signaled);
+    pthread_cond_signal(&b->signal);
+    pthread_mutex_unlock(&b->mutex_signaled);
+}
+
+static void unlockMutex(void* m) {
+    pthread_mutex_unlock((pthread_mutex_t*)m);
+}
+
 int Event::wait(long long timeoutNanoseconds, bool wait_all, int n, Event* e[]) {
+    return waitEx(timeoutNanoseconds, wait_all, false, n, e);
+}
+
+/* alertable waits add the thread's auto-reset APC event as the last one: any wait (and
+   waitAll) is satisfied by it and returns EVENT_WAIT_IO_COMPLETION after running the APCs */
+
+int Event::waitEx(long long timeoutNanoseconds, bool wait_all, bool alertable, int n, Event* e[]) {
     if (n <= 0) {
         return EVENT_WAIT_FAILED;
     }
+    Thread* thread = alertable ? Thread::current() : null;
+    if (thread == null || e[0]->named != null) {
+        return waitLocal(timeoutNanoseconds, wait_all, n, e, -1);
+    }
+    Event* events[n + 1];
+    memcpy(events, e, n * sizeof(Event*));
+    events[n] = thread->apc;
+    long long deadline = timeoutNanoseconds == EVENT_INFINITE ? -1 : SystemTime::mono() + timeoutNanoseconds;
+    for (;;) {
+        int r = waitLocal(timeoutNanoseconds, wait_all, n + 1, events, n);
+        if (r != EVENT_WAIT_IO_COMPLETION || thread->runApcs() > 0) {
+            return r;
+        }
+        // APC event was set for APCs an earlier alertable wait already ran: wait again
+        if (deadline >= 0) {
+            timeoutNanoseconds = deadline - SystemTime::mono();
+            timeoutNanoseconds = timeoutNanoseconds < 0 ? 0 : timeoutNanoseconds;
+        }
+    }
+}
+
+/* the thread's auto-reset message event is set only when its inbox becomes non-empty and
+   may be left signaled by a batch already received: such wakeups are not reported */
+
+int Event::waitAnyOrMessage(long long timeoutNanoseconds, int n, Event* e[]) {
+    Thread* thread = Thread::current();
+    if (thread == null) {
+        return waitEx(timeoutNanoseconds, false, false, n, e);
+    }
+    for (int i = 0; i < n; i++) {
+        assert(e[i]->named == null); // named events cannot be waited together with messages
+        if (e[i]->named != null) {
+            return EVENT_WAIT_FAILED;
+        }
+    }
+    if (Thread::hasMessages()) { // events still take precedence: poll them without sleeping
+        int r = n > 0 ? waitLocal(0, false, n, e, -1) : EVENT_WAIT_TIMEOUT;
+        return r == EVENT_WAIT_TIMEOUT ? EVENT_WAIT_OBJECT_0 + n : r;
+    }
+    Event* events[n + 1];
+    memcpy(events, e, n * sizeof(Event*));
+    events[n] = thread->message;
+    long long deadline = timeoutNanoseconds == EVENT_INFINITE ? -1 : SystemTime::mono() + timeoutNanoseconds;
+    for (;;) {
+        int r = waitLocal(timeoutNanoseconds, false, n + 1, events, -1);
+        if (r != EVENT_WAIT_OBJECT_0 + n || Thread::hasMessages()) {
+            return r;
+        }
+        if (deadline >= 0) {
+            timeoutNanoseconds = deadline - SystemTime::mono();
+            timeoutNanoseconds = timeoutNanoseconds < 0 ? 0 : timeoutNanoseconds;
+        }
+    }
+}
+
+int Event::waitLocal(long long timeoutNanoseconds, bool wait_all, int n, Event* e[], int alert) {
     bool signaled[n];
     memset(&signaled, 0, sizeof(signaled));
-    int return_value = EVENT_WAIT_OBJECT_0;
     Blocked waiting;
     memset(&waiting, 0, sizeof(waiting));
     waiting.n = n;
+    waiting.wait_all = wait_all;
+    waiting.satisfied = -1;
     waiting.signaled = signaled;
     waiting.events = e;
+    waiting.alert = alert;
+    for (int i = 0; i < n; i++) {
+        if (e[i]->failed) { // named event that could not be opened
+            return EVENT_WAIT_FAILED;
+        }
+    }
     if (checkDuplicates(waiting)) {
         return EVENT_WAIT_FAILED;
     }
-    lock(n, e);
-    for (int i = 0; i < n; i++) {
-        waiting.signaled[i] = waiting.events[i]->signaled;
+    int named_count = 0;
+    for (int i = 0; i < n; i++) { named_count += e[i]->named != null; }
+    if (named_count > 0) {
+        assert(named_count == n); // cannot mix named and process local events in one wait
+        return named_count == n ? waitNamed(timeoutNanoseconds, wait_all, n, e) : EVENT_WAIT_FAILED;
     }
-    bool all = false;
-    int first = checkSignaled(waiting, all);
-    if ((wait_all && !all) || first < 0) {
-        struct timespec ts = {0};
+    if (n == 1 && alert < 0 && e[0]->manual && !e[0]->realtime && FiberScheduler::current() == null &&
+        (timeoutNanoseconds == EVENT_INFINITE || !SystemTime::isVirtual())) {
+        return e[0]->waitBroadcast(timeoutNanoseconds);
+    }
+    Event* sorted[n];
+    order(n, e, sorted);
+    lock(n, sorted);
+    int return_value = acquire(waiting);
+    if (return_value < 0) {
+        struct timespec ts = {0, 0};
+        long long deadline = -1;
         if (timeoutNanoseconds != EVENT_INFINITE) {
-            SystemTime::toTimespec(ts, SystemTime::mono() + timeoutNanoseconds);
+            deadline = SystemTime::mono() + timeoutNanoseconds;
+            SystemTime::toTimespec(ts, deadline);
         }
+        FiberScheduler* scheduler = FiberScheduler::current();
+        waiting.fiber = scheduler != null ? Fiber::current() : null;
+        SystemTime::Timer timer = { deadline, virtualTimeout, &waiting, null };
+        // fibers: FiberScheduler::run() times out parked fibers by the virtual clock itself
+        bool virtual_time = deadline >= 0 && scheduler == null && SystemTime::isVirtual();
 #if defined(CLOCK_MONOTONIC) && !defined(__ANDROID__) // see: http://code.google.com/p/android/issues/detail?id=36086
         if (clock_monotonic == null) {
             clock_monotonic = &clock_monotonic_imp;
@@ -276,43 +753,425 @@ int Event::wait(long long timeoutNanoseconds, bool wait_all, int n, Event* e[])
             pthread_condattr_setclock(clock_monotonic, CLOCK_MONOTONIC);
         }
 #endif
-        pthread_mutex_init(&waiting.mutex_signaled, null);
+        bool realtime = false;
+        for (int i = 0; i < n; i++) { realtime = realtime || e[i]->realtime; }
+        if (realtime) {
+            priorityInheritMutexInit(&waiting.mutex_signaled);
+        } else {
+            pthread_mutex_init(&waiting.mutex_signaled, null);
+        }
         pthread_cond_init(&waiting.signal, clock_monotonic);
-        for (int i = 0; i < n; i++) { e[i]->insert(&waiting); }
-        bool done = false;
-        while (!done) {
+        if (virtual_time) { // timeout comes from SystemTime::advance(): wait without timeout
+            SystemTime::addTimer(&timer); // may fire at once: mutex and condvar must be initialized
+        }
+        Link links[n];
+        memset(&links, 0, sizeof(links));
+        waiting.links = links;
+        int priority = realtime ? schedulingPriority() : 0;
+        for (int i = 0; i < n; i++) {
+            links[i].blocked = &waiting;
+            links[i].priority = priority;
+            e[i]->insert(&links[i]);
+        }
+        TRACE(TRACE_WAIT_BEGIN, e[0]);
+        while (return_value < 0) {
             pthread_mutex_lock(&waiting.mutex_signaled);
-            unlock(n, e);
-            int r;
-            if (timeoutNanoseconds == EVENT_INFINITE) {
-                r = pthread_cond_wait(&waiting.signal, &waiting.mutex_signaled);
-            } else {
-                r = monotonic_cond_timedwait(&waiting.signal, &waiting.mutex_signaled, &ts);
+            unlock(n, sorted);
+            int r = 0;
+            Event* woken_by = null;
+            long long latency = 0;
+            // spurious and partial (waitAll) wakeups do not touch the events locks
+            while (r == 0 && !isSatisfied(waiting)) {
+                if (virtual_time && SystemTime::mono() >= deadline) {
+                    r = ETIMEDOUT;
+                } else if (scheduler != null) { // park the fiber only: the thread runs other fibers
+                    r = scheduler->park(deadline, unlockMutex, &waiting.mutex_signaled) ? 0 : ETIMEDOUT;
+                    pthread_mutex_lock(&waiting.mutex_signaled);
+                } else if (timeoutNanoseconds == EVENT_INFINITE || virtual_time) {
+                    Thread::blockBegin();
+                    r = pthread_cond_wait(&waiting.signal, &waiting.mutex_signaled);
+                    Thread::blockEnd();
+                } else {
+                    Thread::blockBegin();
+                    r = monotonic_cond_timedwait(&waiting.signal, &waiting.mutex_signaled, &ts);
+                    Thread::blockEnd();
+                }
+                if (waiting.woken_by != null) {
+                    woken_by = waiting.woken_by;
+                    latency = SystemTime::realMono() - waiting.set_time;
+                    waiting.woken_by = null;
+                }
             }
             pthread_mutex_unlock(&waiting.mutex_signaled);
-            lock(n, e);
-            first = checkSignaled(waiting, all);
-            if (r == ETIMEDOUT) {
+            lock(n, sorted);
+            if (woken_by != null && latency > woken_by->worst_latency) {
+                woken_by->worst_latency = latency;
+            }
+            if (!wait_all && waiting.satisfied >= 0) { // even if timed out: already consumed
+                return_value = waiting.satisfied == alert ? EVENT_WAIT_IO_COMPLETION : EVENT_WAIT_OBJECT_0 + waiting.satisfied;
+            } else if (wait_all && (return_value = acquire(waiting)) >= 0) {
+                // all signaled: consumed atomically while holding all locks
+            } else if (r == ETIMEDOUT) {
                 return_value = EVENT_WAIT_TIMEOUT;
-                done = true;
             } else if (r != 0) {
                 return_value = EVENT_WAIT_FAILED;
-                done = true;
-            } else if (!wait_all && first >= 0) {
-                return_value = EVENT_WAIT_OBJECT_0 + first;
-                done = true;
-            } else {
-                done = wait_all && all;
-            }
-            if (done) {
-                for (int i = 0; i < n; i++) { e[i]->remove(&waiting); }
             }
         }
+        if (virtual_time) {
+            SystemTime::removeTimer(&timer);
+        }
+        for (int i = 0; i < n; i++) { e[i]->remove(&links[i]); }
+        TRACE(return_value == EVENT_WAIT_TIMEOUT ? TRACE_TIMEOUT : TRACE_WAKE,
+              e[EVENT_WAIT_OBJECT_0 < return_value && return_value < n ? return_value - EVENT_WAIT_OBJECT_0 : 0]);
+        if (return_value != EVENT_WAIT_TIMEOUT && waiting.setter != 0) {
+            TRACE_WOKEN_BY(waiting.setter, waiting.set_ticks);
+        }
         pthread_cond_destroy(&waiting.signal);
         pthread_mutex_destroy(&waiting.mutex_signaled);
     }
-    unlock(n, e);
+    unlock(n, sorted);
     return return_value;
 }
 
+static void sharedMutexInit(pthread_mutex_t* m) {
+    pthread_mutexattr_t a;
+    pthread_mutexattr_init(&a);
+    pthread_mutexattr_setpshared(&a, PTHREAD_PROCESS_SHARED);
+#ifdef ROBUST_MUTEX
+    pthread_mutexattr_setrobust(&a, PTHREAD_MUTEX_ROBUST);
+#endif
+    pthread_mutex_init(m, &a);
+    pthread_mutexattr_destroy(&a);
+}
+
+static bool sharedMutexLock(pthread_mutex_t* m) { // true if the owner died holding the lock
+    int r = pthread_mutex_lock(m);
+    bool died = false;
+#ifdef ROBUST_MUTEX
+    if (r == EOWNERDEAD) { // the caller repairs what the owner left half done
+        died = true;
+        r = pthread_mutex_consistent(m);
+    }
+#endif
+    assert(r == 0);
+    return died;
+}
+
+/* process local: the mapping is valid while this process has named events open */
+static void* volatile named_table; // Event::NamedTable
+static pthread_mutex_t named_table_mutex = PTHREAD_MUTEX_INITIALIZER; // opens and closes
+static int named_self;       // this process's entry in the table's processes
+static pid_t named_pid;      // getpid() when the entry was claimed: differs in a fork() child
+static int named_opened;     // named events opened by this process
+static bool named_inherited; // mapped by the parent before fork(): its events may still be used
+
+Event::NamedTable* Event::namedTable() {
+    return (NamedTable*)__atomic_load_n(&named_table, __ATOMIC_ACQUIRE);
+}
+
+void Event::reap(NamedTable* t) { // under t->mutex
+    for (int i = 0; i < NAMED_PROCESSES_MAX; i++) {
+        pid_t pid = t->processes[i];
+        if (pid == 0 || kill(pid, 0) == 0 || errno != ESRCH) {
+            continue;
+        }
+        t->processes[i] = 0;
+        t->waiters[i] = 0;
+        for (int k = 0; k < NAMED_EVENTS_MAX; k++) {
+            Named* s = &t->events[k];
+            s->refs[i] = 0;
+            s->waiters[i] = 0;
+            bool used = false;
+            for (int j = 0; j < NAMED_PROCESSES_MAX && !used; j++) { used = s->refs[j] > 0; }
+            if (!used) {
+                s->name[0] = 0;
+            }
+        }
+    }
+}
+
+/* A process that died holding the table lock can leave a slot with a half copied name and
+   no references (openNamed() claims the slot before refs++): reap() drops the dead
+   process's references and waiters, then every named slot nobody references is freed.
+   processes[] entries and unlinked are single stores */
+
+void Event::lockTable(NamedTable* t) {
+    if (sharedMutexLock(&t->mutex)) {
+        reap(t);
+        for (int k = 0; k < NAMED_EVENTS_MAX; k++) {
+            Named* s = &t->events[k];
+            bool used = false;
+            for (int j = 0; j < NAMED_PROCESSES_MAX && !used; j++) { used = s->refs[j] > 0; }
+            if (!used) {
+                s->name[0] = 0;
+            }
+        }
+    }
+}
+
+static void unlinkAbandoned(int fd) { // only if the name still refers to the segment open as fd
+    int named = shm_open(NAMED_EVENTS_SHM, O_RDONLY, 0);
+    if (named >= 0) {
+        struct stat a, b;
+        if (fstat(fd, &a) == 0 && fstat(named, &b) == 0 && a.st_dev == b.st_dev && a.st_ino == b.st_ino) {
+            shm_unlink(NAMED_EVENTS_SHM);
+        }
+        ::close(named);
+    }
+}
+
+/* maps the segment (creating it if needed) and claims an entry for this process; a segment
+   that never got initialized (creator died) or was left by a process that died while
+   detaching is unlinked and created again */
+
+Event::NamedTable* Event::attachNamed() { // under named_table_mutex
+    for (int attempt = 0; attempt < 3; attempt++) {
+        int fd = shm_open(NAMED_EVENTS_SHM, O_RDWR | O_CREAT | O_EXCL, 0666);
+        bool creator = fd >= 0;
+        if (!creator) {
+            fd = shm_open(NAMED_EVENTS_SHM, O_RDWR, 0666);
+            if (fd < 0 && errno == ENOENT) {
+                continue; // unlinked meanwhile
+            }
+        }
+        if (fd < 0) {
+            return null;
+        }
+        int r = creator ? ftruncate(fd, sizeof(NamedTable)) : 0;
+        for (int i = 0; r == 0 && !creator; i++) { // wait for creator to size the segment
+            struct stat st;
+            r = fstat(fd, &st);
+            if (r == 0 && st.st_size >= (off_t)sizeof(NamedTable)) {
+                break;
+            }
+            r = i < 1000 ? r : -1;
+            SystemTime::sleep(NANOSECONDS_IN_MILLISECOND);
+        }
+        void* p = r != 0 ? MAP_FAILED : mmap(null, sizeof(NamedTable), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        NamedTable* t = p != MAP_FAILED ? (NamedTable*)p : null;
+        if (t != null && creator) {
+            sharedMutexInit(&t->mutex);
+            for (int i = 0; i < NAMED_EVENTS_MAX; i++) { sharedMutexInit(&t->events[i].mutex); }
+            __atomic_store_n(&t->magic, NAMED_EVENTS_MAGIC, __ATOMIC_RELEASE);
+        }
+        for (int i = 0; t != null && i < 1000 && __atomic_load_n(&t->magic, __ATOMIC_ACQUIRE) != NAMED_EVENTS_MAGIC; i++) {
+            SystemTime::sleep(NANOSECONDS_IN_MILLISECOND);
+        }
+        bool abandoned = t != null ? t->magic != NAMED_EVENTS_MAGIC : creator || r != 0;
+        int self = -1;
+        if (t != null && !abandoned) {
+            lockTable(t);
+            abandoned = t->unlinked != 0;
+            if (!abandoned) {
+                reap(t);
+                for (int i = 0; i < NAMED_PROCESSES_MAX && self < 0; i++) {
+                    self = t->processes[i] == 0 ? i : -1;
+                }
+                if (self >= 0) {
+                    t->processes[self] = getpid();
+                }
+            }
+            pthread_mutex_unlock(&t->mutex);
+        }
+        if (abandoned) {
+            unlinkAbandoned(fd);
+        }
+        ::close(fd);
+        if (self >= 0) {
+            named_self = self;
+            named_pid = getpid();
+            return t;
+        }
+        if (t != null) {
+            munmap(t, sizeof(NamedTable));
+        }
+        if (!abandoned) {
+            return null; // NAMED_PROCESSES_MAX processes attached or mapping failed
+        }
+    }
+    return null;
+}
+
+void Event::detachNamed(NamedTable* t) { // under named_table_mutex
+    if (!named_inherited) {
+        __atomic_store_n(&named_table, (void*)null, __ATOMIC_RELEASE);
+    }
+    lockTable(t);
+    reap(t);
+    t->processes[named_self] = 0;
+    t->waiters[named_self] = 0;
+    bool last = true;
+    for (int i = 0; i < NAMED_PROCESSES_MAX && last; i++) { last = t->processes[i] == 0; }
+    if (last) { // nobody can attach to it any more: openers that mapped it see unlinked and retry
+        t->unlinked = 1;
+        shm_unlink(NAMED_EVENTS_SHM);
+    }
+    pthread_mutex_unlock(&t->mutex);
+    if (!named_inherited) {
+        munmap(t, sizeof(NamedTable));
+    }
+}
+
+Event::Named* Event::openNamed(const char* name, bool manual_reset, bool initial_state) {
+    if (name == null || strlen(name) >= NAMED_EVENT_NAME_MAX) {
+        return null;
+    }
+    pthread_mutex_lock(&named_table_mutex);
+    NamedTable* t = namedTable();
+    if (t != null && named_pid != getpid()) { // fork() child: inherited the mapping, not the entry
+        lockTable(t);
+        reap(t);
+        int self = -1;
+        for (int i = 0; i < NAMED_PROCESSES_MAX && self < 0; i++) {
+            self = t->processes[i] == 0 ? i : -1;
+        }
+        if (self >= 0) {
+            t->processes[self] = getpid();
+            named_self = self;
+            named_pid = getpid();
+            named_opened = 0;
+            named_inherited = true;
+        }
+        pthread_mutex_unlock(&t->mutex);
+        if (self < 0) {
+            pthread_mutex_unlock(&named_table_mutex);
+            return null;
+        }
+    }
+    if (t == null) {
+        t = attachNamed();
+        if (t == null) {
+            pthread_mutex_unlock(&named_table_mutex);
+            return null;
+        }
+        named_opened = 0;
+        named_inherited = false;
+        __atomic_store_n(&named_table, (void*)t, __ATOMIC_RELEASE);
+    }
+    Named* found = null;
+    Named* spare = null;
+    lockTable(t);
+    reap(t);
+    for (int i = 0; i < NAMED_EVENTS_MAX && found == null; i++) {
+        Named* s = &t->events[i];
+        if (s->name[0] != 0 && strcmp(s->name, name) == 0) {
+            found = s;
+        } else if (s->name[0] == 0 && spare == null) {
+            spare = s;
+        }
+    }
+    if (found == null && spare != null) {
+        found = spare;
+        strcpy(found->name, name);
+        found->manual = manual_reset;
+        found->signaled = initial_state;
+    }
+    if (found != null) {
+        found->refs[named_self]++;
+        named_opened++;
+    }
+    pthread_mutex_unlock(&t->mutex);
+    if (named_opened == 0) { // table full and nothing else open
+        detachNamed(t);
+    }
+    pthread_mutex_unlock(&named_table_mutex);
+    return found;
+}
+
+void Event::closeNamed(Named* s) {
+    pthread_mutex_lock(&named_table_mutex);
+    NamedTable* t = namedTable();
+    lockTable(t);
+    bool inherited = named_pid != getpid() || s->refs[named_self] == 0; // opened before fork()
+    if (!inherited) {
+        if (--s->refs[named_self] == 0) {
+            reap(t); // frees the slot if no other live process has it open
+            bool used = false;
+            for (int i = 0; i < NAMED_PROCESSES_MAX && !used; i++) { used = s->refs[i] > 0; }
+            if (!used) {
+                s->name[0] = 0;
+            }
+        }
+        named_opened--;
+    }
+    pthread_mutex_unlock(&t->mutex);
+    if (!inherited && named_opened == 0) {
+        detachNamed(t);
+    }
+    pthread_mutex_unlock(&named_table_mutex);
+}
+
+void Event::lockNamed(int n, Event* sorted[]) {
+    for (int i = 0; i < n; i++) {
+        Named* s = sorted[i]->named;
+        if (sharedMutexLock(&s->mutex)) { // set() may have died between signaled and seq:
+            __atomic_add_fetch(&s->seq, 1, __ATOMIC_SEQ_CST); // waiters look at signaled again
+            Futex::wakeAll(&s->seq, true);
+            NamedTable* t = namedTable();
+            __atomic_add_fetch(&t->epoch, 1, __ATOMIC_SEQ_CST);
+            Futex::wakeAll(&t->epoch, true);
+        }
+    }
+}
+
+void Event::unlockNamed(int n, Event* sorted[]) {
+    for (int i = n - 1; i >= 0; i--) { pthread_mutex_unlock(&sorted[i]->named->mutex); }
+}
+
+int Event::waitNamed(long long timeoutNanoseconds, bool wait_all, int n, Event* e[]) {
+    NamedTable* t = namedTable();
+    long long deadline = timeoutNanoseconds == EVENT_INFINITE ? 0 : SystemTime::realMono() + timeoutNanoseconds;
+    bool blocked = false;
+    Event* sorted[n];
+    order(n, e, sorted);
+    for (;;) {
+        lockNamed(n, sorted);
+        int first = -1;
+        bool all = true;
+        for (int i = 0; i < n; i++) {
+            if (e[i]->named->signaled) {
+                first = first < 0 ? i : first;
+            } else {
+                all = false;
+            }
+        }
+        if (wait_all ? all : first >= 0) {
+            for (int i = wait_all ? 0 : first; i < (wait_all ? n : first + 1); i++) {
+                if (!e[i]->named->manual) {
+                    e[i]->named->signaled = false;
+                }
+            }
+            unlockNamed(n, sorted);
+            if (blocked) {
+                TRACE(TRACE_WAKE, e[wait_all ? 0 : first]);
+            }
+            return EVENT_WAIT_OBJECT_0 + (wait_all ? 0 : first);
+        }
+        long long timeout = EVENT_INFINITE;
+        if (timeoutNanoseconds != EVENT_INFINITE) {
+            timeout = deadline - SystemTime::realMono();
+            if (timeout <= 0) {
+                unlockNamed(n, sorted);
+                if (blocked) {
+                    TRACE(TRACE_TIMEOUT, e[0]);
+                }
+                return EVENT_WAIT_TIMEOUT;
+            }
+        }
+        volatile int* futex = n == 1 ? &e[0]->named->seq : &t->epoch;
+        volatile int* waiters = n == 1 ? &e[0]->named->waiters[named_self] : &t->waiters[named_self];
+        __atomic_add_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+        int expected = *futex;
+        unlockNamed(n, sorted);
+        if (!blocked) {
+            TRACE(TRACE_WAIT_BEGIN, e[0]);
+            blocked = true;
+        }
+        Thread::blockBegin();
+        Futex::wait(futex, expected, timeout, true);
+        Thread::blockEnd();
+        __atomic_sub_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
 #endif
@@ -39,17 +39,41 @@ enum { /* EVENT_ prefix because of Win32 #defines with the same names and values
     EVENT_WAIT_OBJECT_0 = 0,
     EVENT_WAIT_TIMEOUT = 0x00000102,
     EVENT_WAIT_FAILED = -1,
-    EVENT_WAIT_ABANDONED = 0x00000080
+    EVENT_WAIT_ABANDONED = 0x00000080,
+    EVENT_WAIT_IO_COMPLETION = 0x000000C0 /* alertable wait ran APCs queued with Thread::queueApc() */
+};
+
+enum { /* Event options */
+    EVENT_REALTIME = 0x1 /* priority inheritance locks, waiters are woken in priority then FIFO order
+                            and worst case wake latency is measured (POSIX only, ignored on Win32);
+                            the wait for set() itself is not priority inheriting, see Event.cpp */
 };
 
 class Event {
 public:
     Event(bool manual_reset = false, bool initial_state = false);
+    /* named events are shared between processes: if an event with the same name already exists
+       it is opened and manual_reset, initial_state are ignored (same as Win32 CreateEvent).
+       Check isValid(): if it could not be created or opened (name too long, table of named
+       events full, no shared memory) set() and reset() do nothing and waits return
+       EVENT_WAIT_FAILED (Win32: CreateEvent returned null) */
+    Event(const char* name, bool manual_reset = false, bool initial_state = false);
+    Event(bool manual_reset, bool initial_state, int options);
     virtual ~Event();
+    bool isValid();
     Event& set();
     Event& reset();
+    /* called from a FiberScheduler fiber all waits (except on named events) park the fiber
+       instead of blocking the thread (POSIX only: Win32 waits always block the thread) */
     int wait(long long timeoutNanoseconds);
     int wait();
+    /* alertable wait (WaitForSingleObjectEx): APCs queued to the calling Thread run inside
+       the wait which then returns EVENT_WAIT_IO_COMPLETION. Threads not created by Thread
+       have no APC queue and wait as usual. Waits on named events are never alertable */
+    int waitEx(long long timeoutNanoseconds, bool alertable);
+    /* longest time in nanoseconds between set() and the woken waiter running again;
+       measured only for EVENT_REALTIME events, -1 when not measured */
+    long long worstWakeLatency();
 
     static inline int waitAll(long long timeoutNanoseconds, Event& e0, Event& e1) {
         return wait(timeoutNanoseconds, true, 2, &e0, &e1);
@@ -100,23 +124,63 @@ public:
     }
 
     static int wait(long long timeoutNanoseconds, bool wait_all, int n, ...);
+    static int waitEx(long long timeoutNanoseconds, bool wait_all, bool alertable, int n, Event* e[]);
+    /* MsgWaitForMultipleObjects: returns EVENT_WAIT_OBJECT_0 + n when the calling Thread has
+       posted messages (Thread::postMessage) and none of the events is signaled; does not sleep
+       when messages are already queued. Without a Thread inbox same as waitAny */
+    static int waitAnyOrMessage(long long timeoutNanoseconds, int n, Event* e[]);
+
+    static inline int waitAnyOrMessage(long long timeoutNanoseconds, Event& e0) {
+        Event* e[1] = {&e0};
+        return waitAnyOrMessage(timeoutNanoseconds, 1, e);
+    }
 
 private:
     static int wait(long long timeoutNanoseconds, bool wait_all, int n, Event* e[]);
 #ifndef WIN32
+    static int waitLocal(long long timeoutNanoseconds, bool wait_all, int n, Event* e[], int alert);
     struct Blocked;
+    struct Link; // per event list node of a blocked thread
+    void init(bool manual_reset, bool initial_state, int options);
     void notifyAll();
-    void insert(Blocked* b);
-    void remove(Blocked* b);
-    static void lock(int n, Event* e[]);
-    static void unlock(int n, Event* e[]);
-    static void markSignaled(Blocked& b, Event* e);
+    void insert(Link* l);
+    void remove(Link* l);
+    static void order(int n, Event* e[], Event* sorted[]);
+    static void lock(int n, Event* sorted[]);
+    static void unlock(int n, Event* sorted[]);
+    static int  markSignaled(Blocked& b, Event* e);
     static int  checkSignaled(Blocked& b, bool &all);
+    static bool isSatisfied(Blocked& b);
+    static int  acquire(Blocked& b);
     static bool checkDuplicates(Blocked &b);
-    Blocked* start; // list of blocked threads waiting for this event
-    Blocked* end;
+    static void virtualTimeout(void* blocked);
+    struct Named;      // process-shared state of named event
+    struct NamedTable; // shared memory segment with all named events
+    static NamedTable* namedTable(); /* mapped while the process has named events open */
+    static NamedTable* attachNamed();
+    static void detachNamed(NamedTable* t);
+    static void reap(NamedTable* t); /* drops references and waiters of processes that died */
+    static void lockTable(NamedTable* t); /* repairs the table if its lock owner died */
+    static Named* openNamed(const char* name, bool manual_reset, bool initial_state);
+    static void closeNamed(Named* s);
+    static void lockNamed(int n, Event* sorted[]);
+    static void unlockNamed(int n, Event* sorted[]);
+    static int  waitNamed(long long timeoutNanoseconds, bool wait_all, int n, Event* e[]);
+    int waitBroadcast(long long timeoutNanoseconds); /* single event wait on manual-reset event */
+    Named* named; // null for process local events
+    Link* start; // list of blocked threads waiting for this event
+    Link* end;
+    long long worst_latency;
+    long long set_ticks;
+    volatile int generation; // futex: bumped by set() to release waitBroadcast() sleepers
+    int waiting;             // sleepers of the current generation (under mutex)
+    volatile int released;   // sleepers released by set() that have not returned yet
+    volatile int waking;     // set() calls that still have to wake the sleepers
+    int setter;              // EVENT_TRACE: last set() that released sleepers, at set_ticks
+    bool failed;  // named event that could not be opened
     bool manual;
     bool signaled;
+    bool realtime;
     pthread_mutex_t mutex;
 #else
     void* handle;
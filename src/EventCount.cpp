@@ -0,0 +1,142 @@
+/*  Copyright (c) 2013, Leo Kuznetsov
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "EventCount.h"
+#include "Event.h"
+#include "Thread.h"
+#include "Futex.h"
+#include "Atomic.h"
+#include "SystemTime.h"
+
+#define null NULL
+
+#ifdef WIN32
+#pragma warning(disable: 4820 4514 4668 4711)
+#endif
+
+/* waiter: waiters++ then reads the epoch and checks the condition; notifier: publishes
+   then reads waiters. All four are sequentially consistent so they are in one total
+   order and at least one side sees the other's store: either the waiter finds the data
+   or the notifier bumps the epoch the waiter is about to sleep on.
+   notify() only signals while there are fewer signals than waiters and every waiter
+   leaving consumes one: a producer does not issue a futex wake per item while a woken
+   consumer has not run yet (as in Eigen's EventCount) */
+
+EventCount::EventCount() : epoch(0), state(0) {
+}
+
+EventCount::Key EventCount::prepareWait() {
+    Atomic::add(&state, WAITER);
+    return Atomic::load(&epoch);
+}
+
+void EventCount::leave() {
+    for (;;) {
+        int s = Atomic::load(&state);
+        if (Atomic::compareExchange(&state, s, s - WAITER - (s >= SIGNAL ? SIGNAL : 0))) {
+            return;
+        }
+    }
+}
+
+void EventCount::cancelWait() {
+    leave();
+}
+
+struct Expiry {
+    volatile int* epoch;
+    volatile int expired;
+};
+
+void EventCount::expired(void* p) { // other waiters see a spurious wakeup
+    Expiry* e = (Expiry*)p;
+    Atomic::store(&e->expired, 1);
+    Atomic::add(e->epoch, 1);
+    Futex::wakeAll(e->epoch);
+}
+
+int EventCount::commitWait(Key key, long long timeoutNanoseconds) {
+    int r = EVENT_WAIT_OBJECT_0;
+    if (Atomic::load(&epoch) == key) {
+        long long deadline = timeoutNanoseconds < 0 ? -1 : SystemTime::mono() + timeoutNanoseconds;
+        bool virtual_time = deadline >= 0 && SystemTime::isVirtual();
+        Expiry expiry = { &epoch, 0 };
+        SystemTime::Timer timer = { deadline, expired, &expiry, null };
+        if (virtual_time) {
+            SystemTime::addTimer(&timer);
+        }
+        Thread::blockBegin();
+        while (Atomic::load(&epoch) == key) {
+            long long timeout = -1;
+            if (deadline >= 0 && !virtual_time) {
+                timeout = deadline - SystemTime::mono();
+                if (timeout <= 0) {
+                    r = EVENT_WAIT_TIMEOUT;
+                    break;
+                }
+            }
+            Futex::wait(&epoch, key, timeout);
+        }
+        Thread::blockEnd();
+        if (virtual_time) {
+            SystemTime::removeTimer(&timer); // waits for expired() to return
+            r = Atomic::load(&expiry.expired) ? EVENT_WAIT_TIMEOUT : r;
+        }
+    }
+    leave();
+    return r;
+}
+
+void EventCount::notify() {
+    for (;;) {
+        int s = Atomic::load(&state);
+        if ((s & (SIGNAL - 1)) <= s / SIGNAL) { // nobody waits or all are signaled already
+            return;
+        }
+        if (Atomic::compareExchange(&state, s, s + SIGNAL)) {
+            Atomic::add(&epoch, 1);
+            Futex::wake(&epoch, 1);
+            return;
+        }
+    }
+}
+
+void EventCount::notifyAll() {
+    for (;;) {
+        int s = Atomic::load(&state);
+        int waiters = s & (SIGNAL - 1);
+        if (waiters <= s / SIGNAL) {
+            return;
+        }
+        if (Atomic::compareExchange(&state, s, waiters * SIGNAL + waiters)) {
+            Atomic::add(&epoch, 1);
+            Futex::wakeAll(&epoch);
+            return;
+        }
+    }
+}
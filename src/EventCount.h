@@ -0,0 +1,72 @@
+/*  Copyright (c) 2013, Leo Kuznetsov
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+#ifndef __EVENT_COUNT_H__
+#define __EVENT_COUNT_H__
+
+/* Event count (Dekker style, as in Folly and Eigen) for sleeping on lock-free data
+   structures without lost wakeups:
+
+       for (;;) {
+           if (queue.tryPop(v)) { break; }
+           EventCount::Key key = ec.prepareWait();
+           if (queue.tryPop(v)) { ec.cancelWait(); break; }
+           ec.commitWait(key);
+       }
+
+   and producers call notify() after publishing. notify() is one atomic load when nobody
+   waits: no fence, no lock, no syscall. The caller must publish with a sequentially
+   consistent store or read-modify-write (any Atomic:: store, add or compareExchange) and
+   the waiter check the condition with Atomic:: loads: that orders the publishing store
+   before notify()'s load of the waiters count. */
+
+class EventCount {
+public:
+    typedef int Key;
+    EventCount();
+    Key prepareWait();
+    void cancelWait();
+    /* sleeps unless notify() was called after prepareWait(); returns EVENT_WAIT_OBJECT_0
+       (also for spurious wakeups: check the condition again) or EVENT_WAIT_TIMEOUT,
+       timeoutNanoseconds < 0 (EVENT_INFINITE) means infinite */
+    int commitWait(Key key, long long timeoutNanoseconds = -1);
+    void notify();
+    void notifyAll();
+private:
+    static void expired(void* p);
+    enum { WAITER = 1, SIGNAL = 1 << 16 };
+    volatile int epoch; // futex: incremented by notify() when it signals a waiter
+    volatile int state; // waiters between prepareWait() and commitWait()/cancelWait()
+                        // | their signals not yet consumed * SIGNAL
+    void leave();
+    EventCount(const EventCount&); // not copyable
+    EventCount& operator=(const EventCount&);
+};
+
+#endif /* __EVENT_COUNT_H__ */
@@ -0,0 +1,386 @@
+/*  Copyright (c) 2013, Leo Kuznetsov
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "Fiber.h"
+#include <assert.h>
+#include <string.h>
+
+#define null NULL
+
+#ifdef WIN32
+#pragma warning(disable: 4820 4514 4668 4711)
+#include <Windows.h>
+
+static __declspec(thread) Fiber* current_fiber;
+static __declspec(thread) void* thread_fiber; // ConvertThreadToFiber() result
+
+void __stdcall Fiber::winEntry(void* p) {
+    entry((Fiber*)p); // never returns: returning from fiber proc would exit the thread
+}
+
+Fiber::Fiber(void (*func)(void*), void* a, size_t size) :
+    f(func), arg(a), context(null), caller_context(null), caller(null), stack(null), stack_size(size), done(false),
+    scheduler(null), next(null), timer_next(null), deadline(-1), parked(false), timedout(false), in_timers(false) {
+    context = ::CreateFiber(size, winEntry, this);
+    assert(context != null);
+}
+
+Fiber::~Fiber() {
+    assert(current_fiber != this);
+    ::DeleteFiber(context);
+}
+
+void Fiber::entry(Fiber* fiber) {
+    fiber->f(fiber->arg);
+    fiber->done = true;
+    switchBack();
+}
+
+void Fiber::switchTo() {
+    assert(!done && current_fiber != this);
+    if (current_fiber == null && thread_fiber == null) {
+        thread_fiber = ::ConvertThreadToFiber(null);
+    }
+    caller = current_fiber;
+    caller_context = caller != null ? caller->context : thread_fiber;
+    current_fiber = this;
+    ::SwitchToFiber(context);
+}
+
+void Fiber::switchBack() {
+    Fiber* self = current_fiber;
+    current_fiber = self->caller;
+    ::SwitchToFiber(self->caller_context);
+}
+
+Fiber* Fiber::current() {
+    return current_fiber;
+}
+
+#else
+
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+#ifndef FIBER_GUARD_PAGE
+#define FIBER_GUARD_PAGE 1
+#endif
+
+#if !defined(FIBER_UCONTEXT) && (defined(__x86_64__) || defined(__aarch64__))
+#define FIBER_ASM
+#else
+#include <ucontext.h>
+#endif
+
+#ifdef __MACH__
+#define FIBER_SYMBOL(name) "_" #name
+#else
+#define FIBER_SYMBOL(name) #name
+#endif
+
+struct FiberContext {
+#ifdef FIBER_ASM
+    void* sp; // everything else is saved on the fiber's own stack
+#else
+    ucontext_t uc;
+#endif
+};
+
+static __thread Fiber* current_fiber;
+static __thread FiberContext thread_context; // thread's own context while it runs fibers
+
+#ifdef FIBER_ASM
+
+/* fiber_switch(&from->sp, to->sp): pushes callee saved registers on the current stack,
+   saves stack pointer, switches to the other stack, pops its registers and returns there.
+   A new fiber's stack is prepared to "return" into fiber_start which calls entry(fiber). */
+
+extern "C" void win32posix_fiber_switch(void** from_sp, void* to_sp);
+extern "C" void win32posix_fiber_start();
+
+#if defined(__x86_64__)
+
+__asm__(
+    ".text\n"
+    ".globl " FIBER_SYMBOL(win32posix_fiber_switch) "\n"
+    FIBER_SYMBOL(win32posix_fiber_switch) ":\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    subq $8, %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 4(%rsp)\n"
+    "    addq $8, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".globl " FIBER_SYMBOL(win32posix_fiber_start) "\n"
+    FIBER_SYMBOL(win32posix_fiber_start) ":\n"
+    "    movq %r12, %rdi\n"
+    "    callq *%r13\n"
+    "    ud2\n"
+);
+
+static void contextInit(FiberContext* c, void* stack, size_t size, Fiber* fiber, void (*entry)(Fiber*)) {
+    unsigned long long top = ((unsigned long long)stack + size) & ~15ULL;
+    unsigned long long* sp = (unsigned long long*)(top - 80); // fiber_start is entered with 16 byte aligned rsp
+    memset(sp, 0, 80);
+    sp[0] = 0x1F80ULL | (0x037FULL << 32); // default mxcsr and x87 control word
+    sp[3] = (unsigned long long)entry;     // r13
+    sp[4] = (unsigned long long)fiber;     // r12
+    sp[7] = (unsigned long long)win32posix_fiber_start; // return address
+    c->sp = sp;
+}
+
+#elif defined(__aarch64__)
+
+__asm__(
+    ".text\n"
+    ".p2align 2\n"
+    ".globl " FIBER_SYMBOL(win32posix_fiber_switch) "\n"
+    FIBER_SYMBOL(win32posix_fiber_switch) ":\n"
+    "    sub sp, sp, #176\n"
+    "    stp x19, x20, [sp, #0]\n"
+    "    stp x21, x22, [sp, #16]\n"
+    "    stp x23, x24, [sp, #32]\n"
+    "    stp x25, x26, [sp, #48]\n"
+    "    stp x27, x28, [sp, #64]\n"
+    "    stp x29, x30, [sp, #80]\n"
+    "    stp d8, d9, [sp, #96]\n"
+    "    stp d10, d11, [sp, #112]\n"
+    "    stp d12, d13, [sp, #128]\n"
+    "    stp d14, d15, [sp, #144]\n"
+    "    mov x9, sp\n"
+    "    str x9, [x0]\n"
+    "    mov sp, x1\n"
+    "    ldp x19, x20, [sp, #0]\n"
+    "    ldp x21, x22, [sp, #16]\n"
+    "    ldp x23, x24, [sp, #32]\n"
+    "    ldp x25, x26, [sp, #48]\n"
+    "    ldp x27, x28, [sp, #64]\n"
+    "    ldp x29, x30, [sp, #80]\n"
+    "    ldp d8, d9, [sp, #96]\n"
+    "    ldp d10, d11, [sp, #112]\n"
+    "    ldp d12, d13, [sp, #128]\n"
+    "    ldp d14, d15, [sp, #144]\n"
+    "    add sp, sp, #176\n"
+    "    ret\n"
+    ".globl " FIBER_SYMBOL(win32posix_fiber_start) "\n"
+    FIBER_SYMBOL(win32posix_fiber_start) ":\n"
+    "    mov x0, x19\n"
+    "    blr x20\n"
+    "    brk #0\n"
+);
+
+static void contextInit(FiberContext* c, void* stack, size_t size, Fiber* fiber, void (*entry)(Fiber*)) {
+    unsigned long long top = ((unsigned long long)stack + size) & ~15ULL;
+    unsigned long long* sp = (unsigned long long*)(top - 176);
+    memset(sp, 0, 176);
+    sp[0] = (unsigned long long)fiber;  // x19
+    sp[1] = (unsigned long long)entry;  // x20
+    sp[11] = (unsigned long long)win32posix_fiber_start; // x30
+    c->sp = sp;
+}
+
+#endif
+
+static inline void contextSwitch(FiberContext* from, FiberContext* to) {
+    win32posix_fiber_switch(&from->sp, to->sp);
+}
+
+#else // ucontext
+
+static void (*ucontext_entry)(Fiber*);
+
+static void ucontextStart(unsigned int hi, unsigned int lo) { // makecontext() passes int arguments only
+    ucontext_entry((Fiber*)(((unsigned long long)hi << 32) | lo));
+}
+
+static void contextInit(FiberContext* c, void* stack, size_t size, Fiber* fiber, void (*entry)(Fiber*)) {
+    ucontext_entry = entry;
+    getcontext(&c->uc);
+    c->uc.uc_stack.ss_sp = stack;
+    c->uc.uc_stack.ss_size = size;
+    c->uc.uc_link = null;
+    unsigned long long p = (unsigned long long)fiber;
+    makecontext(&c->uc, (void (*)())ucontextStart, 2, (unsigned int)(p >> 32), (unsigned int)p);
+}
+
+static inline void contextSwitch(FiberContext* from, FiberContext* to) {
+    swapcontext(&from->uc, &to->uc);
+}
+
+#endif
+
+/* Stack pool: default size stacks are recycled instead of mmap/munmap per fiber.
+   The topmost bytes of every stack hold a small header (free list link, guard flag):
+   that page is touched by any fiber anyway so pooled stacks do not grow the resident set.
+   A guard page costs two memory mappings per stack and mmap() fails for good once
+   vm.max_map_count (65530 by default) is reached: only the first GUARDED_STACKS_MAX live
+   stacks are guarded, the rest merge into a few mappings with their unguarded neighbours. */
+
+enum { STACK_POOL_MAX = 4096, GUARDED_STACKS_MAX = 16384 };
+
+struct StackHeader {
+    void* next; // pool free list
+    bool guarded;
+};
+
+static pthread_mutex_t stack_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static void* stack_pool;
+static int stack_pool_count;
+static int guarded_stacks;
+
+static inline StackHeader* header(void* s, size_t size) {
+    return (StackHeader*)((char*)s + size) - 1;
+}
+
+static size_t pageSize() {
+    static size_t page_size;
+    if (page_size == 0) {
+        page_size = (size_t)sysconf(_SC_PAGESIZE);
+    }
+    return page_size;
+}
+
+static void* stackAllocate(size_t size) {
+    if (size == Fiber::DEFAULT_STACK_SIZE) {
+        pthread_mutex_lock(&stack_pool_mutex);
+        void* s = stack_pool;
+        if (s != null) {
+            stack_pool = header(s, size)->next;
+            stack_pool_count--;
+        }
+        pthread_mutex_unlock(&stack_pool_mutex);
+        if (s != null) {
+            return s;
+        }
+    }
+    size_t page = pageSize(); // guard page is always reserved, protected only when FIBER_GUARD_PAGE
+    // no swap reservation: like thread stacks only the touched pages are ever committed
+    char* p = (char*)mmap(null, size + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+    if (p == (char*)MAP_FAILED) {
+        return null;
+    }
+    bool guarded = false;
+    if (FIBER_GUARD_PAGE) {
+        pthread_mutex_lock(&stack_pool_mutex);
+        guarded = guarded_stacks < GUARDED_STACKS_MAX;
+        guarded_stacks += guarded;
+        pthread_mutex_unlock(&stack_pool_mutex);
+    }
+    if (guarded && mprotect(p, page, PROT_NONE) != 0) { // stacks grow down: overflow faults
+        guarded = false;
+    }
+    header(p + page, size)->guarded = guarded;
+    return p + page;
+}
+
+static void stackFree(void* s, size_t size) {
+    if (size == Fiber::DEFAULT_STACK_SIZE) {
+        pthread_mutex_lock(&stack_pool_mutex);
+        bool pooled = stack_pool_count < STACK_POOL_MAX;
+        if (pooled) {
+            header(s, size)->next = stack_pool;
+            stack_pool = s;
+            stack_pool_count++;
+        }
+        pthread_mutex_unlock(&stack_pool_mutex);
+        if (pooled) {
+            return;
+        }
+    }
+    if (header(s, size)->guarded) {
+        pthread_mutex_lock(&stack_pool_mutex);
+        guarded_stacks--;
+        pthread_mutex_unlock(&stack_pool_mutex);
+    }
+    munmap((char*)s - pageSize(), size + pageSize());
+}
+
+Fiber::Fiber(void (*func)(void*), void* a, size_t size) :
+    f(func), arg(a), context(null), caller_context(null), caller(null), stack(null), stack_size(size), done(false),
+    scheduler(null), next(null), timer_next(null), deadline(-1), parked(false), timedout(false), in_timers(false) {
+    if (stack_size == 0) {
+        stack_size = DEFAULT_STACK_SIZE;
+    }
+    stack_size = (stack_size + pageSize() - 1) & ~(pageSize() - 1);
+    stack = stackAllocate(stack_size);
+    assert(stack != null);
+    FiberContext* c = new FiberContext;
+    contextInit(c, stack, stack_size - sizeof(StackHeader), this, entry);
+    context = c;
+}
+
+Fiber::~Fiber() {
+    assert(current_fiber != this);
+    stackFree(stack, stack_size);
+    delete (FiberContext*)context;
+}
+
+void Fiber::entry(Fiber* fiber) {
+    fiber->f(fiber->arg);
+    fiber->done = true;
+    switchBack(); // never returns
+}
+
+void Fiber::switchTo() {
+    assert(!done && current_fiber != this);
+    caller = current_fiber;
+    caller_context = caller != null ? caller->context : &thread_context;
+    current_fiber = this;
+    contextSwitch((FiberContext*)caller_context, (FiberContext*)context);
+}
+
+void Fiber::switchBack() {
+    Fiber* self = current_fiber;
+    current_fiber = self->caller;
+    contextSwitch((FiberContext*)self->context, (FiberContext*)self->caller_context);
+}
+
+Fiber* Fiber::current() {
+    return current_fiber;
+}
+
+#endif
@@ -0,0 +1,81 @@
+/*  Copyright (c) 2013, Leo Kuznetsov
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+#ifndef __FIBER_H__
+#define __FIBER_H__
+
+#include <stddef.h>
+
+/* Cooperative user space threads a.k.a. Win32 fibers (CreateFiber/SwitchToFiber).
+   POSIX: hand written context switch for x86-64 and aarch64 (callee saved registers only),
+   ucontext elsewhere or when built with -DFIBER_UCONTEXT. Default size stacks come from
+   a process wide pool and have a guard page (two memory mappings per stack: for more than
+   ~30,000 fibers raise vm.max_map_count or build with -DFIBER_GUARD_PAGE=0).
+   Win32: thin wrapper of native fibers. */
+
+class FiberScheduler;
+
+class Fiber {
+public:
+    enum { DEFAULT_STACK_SIZE = 64 * 1024 };
+    Fiber(void (*f)(void*), void* arg = 0, size_t stack_size = 0);
+    virtual ~Fiber(); /* fiber must not be running: finished or switched away from */
+    /* suspends the calling thread or fiber and runs this fiber until it switches
+       to another one or returns; returning resumes the most recent switchTo() caller */
+    void switchTo();
+    bool finished() const { return done; }
+    static Fiber* current(); /* null when called outside of a fiber */
+private:
+    friend class FiberScheduler;
+    static void entry(Fiber* f);
+#ifdef WIN32
+    static void __stdcall winEntry(void* p);
+#endif
+    static void switchBack(); /* from current fiber to its most recent caller */
+    void (*f)(void*);
+    void* arg;
+    void* context;        /* POSIX: FiberContext*, Win32: fiber handle */
+    void* caller_context; /* context to return to */
+    Fiber* caller;        /* null when the caller is the thread itself */
+    void* stack;
+    size_t stack_size;
+    volatile bool done;
+    /* FiberScheduler state */
+    FiberScheduler* scheduler;
+    Fiber* next;          /* ready queue */
+    Fiber* timer_next;    /* parked with deadline */
+    long long deadline;
+    bool parked;
+    bool timedout;
+    bool in_timers;
+    Fiber(const Fiber&); // not copyable
+    Fiber& operator=(const Fiber&);
+};
+
+#endif /* __FIBER_H__ */
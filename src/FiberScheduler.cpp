@@ -0,0 +1,209 @@
+/*  Copyright (c) 2013, Leo Kuznetsov
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "FiberScheduler.h"
+#include "SystemTime.h"
+#include "Thread.h"
+#include <assert.h>
+
+#define null NULL
+
+FiberScheduler::FiberScheduler() : head(null), tail(null), timers(null), live(0), sleeping(false), alarmed(false) {
+}
+
+FiberScheduler::~FiberScheduler() {
+    assert(live == 0);
+}
+
+Fiber* FiberScheduler::spawn(void (*f)(void*), void* arg, size_t stack_size) {
+    Fiber* fiber = new Fiber(f, arg, stack_size);
+    fiber->scheduler = this;
+    lock.acquireExclusive();
+    live++;
+    enqueue(fiber);
+    lock.releaseExclusive();
+    return fiber;
+}
+
+void FiberScheduler::enqueue(Fiber* fiber) {
+    fiber->next = null;
+    if (tail != null) { tail->next = fiber; } else { head = fiber; }
+    tail = fiber;
+    if (sleeping) {
+        idle.wake();
+    }
+}
+
+void FiberScheduler::expire(long long now) {
+    Fiber** p = &timers;
+    while (*p != null) {
+        Fiber* fiber = *p;
+        if (!fiber->parked || fiber->deadline < 0) { // made ready or parked again untimed: drop lazily
+            *p = fiber->timer_next;
+            fiber->in_timers = false;
+        } else if (fiber->deadline <= now) {
+            *p = fiber->timer_next;
+            fiber->in_timers = false;
+            fiber->parked = false;
+            fiber->timedout = true;
+            enqueue(fiber);
+        } else {
+            p = &fiber->timer_next;
+        }
+    }
+}
+
+void FiberScheduler::run() {
+    assert(Fiber::current() == null); // scheduler runs on the thread itself
+    lock.acquireExclusive();
+    while (live > 0) {
+        if (timers != null) {
+            expire(SystemTime::mono());
+        }
+        if (head == null) {
+            long long next = -1;
+            for (Fiber* t = timers; t != null; t = t->timer_next) {
+                if (t->parked && t->deadline >= 0) {
+                    next = next < 0 || t->deadline < next ? t->deadline : next;
+                }
+            }
+            if (next >= 0 && SystemTime::isVirtual()) {
+                idleVirtual(next);
+                continue;
+            }
+            long long timeout = -1;
+            if (next >= 0) {
+                timeout = next - SystemTime::mono();
+                timeout = timeout < 0 ? 0 : timeout;
+            }
+            sleeping = true;
+            Thread::blockBegin();
+            idle.sleep(lock, timeout);
+            Thread::blockEnd();
+            sleeping = false;
+            continue;
+        }
+        Fiber* fiber = head;
+        head = fiber->next;
+        if (head == null) {
+            tail = null;
+        }
+        lock.releaseExclusive();
+        fiber->switchTo();
+        if (fiber->finished()) {
+            lock.acquireExclusive();
+            for (Fiber** p = &timers; fiber->in_timers; p = &(*p)->timer_next) {
+                if (*p == fiber) {
+                    *p = fiber->timer_next;
+                    fiber->in_timers = false;
+                }
+            }
+            live--;
+            lock.releaseExclusive();
+            delete fiber;
+            lock.acquireExclusive();
+        } else {
+            lock.acquireExclusive();
+        }
+    }
+    lock.releaseExclusive();
+}
+
+/* virtual clock: a timer at the nearest deadline wakes the idle scheduler which then
+   expires the fibers at the new SystemTime::mono() */
+
+void FiberScheduler::alarm(void* p) { // under SystemTime's clock lock
+    FiberScheduler* s = (FiberScheduler*)p;
+    s->lock.acquireExclusive();
+    s->alarmed = true;
+    s->idle.wake();
+    s->lock.releaseExclusive();
+}
+
+void FiberScheduler::idleVirtual(long long deadline) { // under lock
+    SystemTime::Timer timer = { deadline, alarm, this, null };
+    alarmed = false;
+    lock.releaseExclusive(); // alarm() takes the lock: may fire inside addTimer()
+    SystemTime::addTimer(&timer);
+    lock.acquireExclusive();
+    sleeping = true;
+    Thread::blockBegin();
+    while (head == null && !alarmed) {
+        idle.sleep(lock);
+    }
+    Thread::blockEnd();
+    sleeping = false;
+    lock.releaseExclusive();
+    SystemTime::removeTimer(&timer); // waits for alarm() to return
+    lock.acquireExclusive();
+}
+
+FiberScheduler* FiberScheduler::current() {
+    Fiber* fiber = Fiber::current();
+    return fiber != null ? fiber->scheduler : null;
+}
+
+void FiberScheduler::yield() {
+    Fiber* fiber = Fiber::current();
+    assert(fiber != null && fiber->scheduler != null);
+    FiberScheduler* s = fiber->scheduler;
+    s->lock.acquireExclusive();
+    s->enqueue(fiber); // the run loop cannot pick it up before switchBack(): same thread
+    s->lock.releaseExclusive();
+    Fiber::switchBack();
+}
+
+bool FiberScheduler::park(long long deadline, void (*unlock)(void*), void* arg) {
+    Fiber* fiber = Fiber::current();
+    assert(fiber != null && fiber->scheduler == this);
+    lock.acquireExclusive();
+    fiber->parked = true;
+    fiber->timedout = false;
+    fiber->deadline = deadline;
+    if (deadline >= 0 && !fiber->in_timers) {
+        fiber->timer_next = timers;
+        timers = fiber;
+        fiber->in_timers = true;
+    }
+    lock.releaseExclusive();
+    if (unlock != null) {
+        unlock(arg);
+    }
+    Fiber::switchBack();
+    return !fiber->timedout;
+}
+
+void FiberScheduler::ready(Fiber* fiber) {
+    FiberScheduler* s = fiber->scheduler;
+    s->lock.acquireExclusive();
+    if (fiber->parked) {
+        fiber->parked = false;
+        s->enqueue(fiber);
+    }
+    s->lock.releaseExclusive();
+}
@@ -0,0 +1,73 @@
+/*  Copyright (c) 2013, Leo Kuznetsov
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+#ifndef __FIBER_SCHEDULER_H__
+#define __FIBER_SCHEDULER_H__
+
+#include "Fiber.h"
+#include "SRWLock.h"
+#include "ConditionVariable.h"
+
+/* Runs fibers on the thread that calls run() until all of them have finished.
+   Event::wait() called from a scheduled fiber parks only that fiber; other threads
+   (and fibers) make it runnable again with Event::set(). Other blocking calls
+   (named events, SRWLock, Futex, sleep...) still block the whole thread. */
+
+class FiberScheduler {
+public:
+    FiberScheduler();
+    virtual ~FiberScheduler();
+    /* the scheduler owns the fiber and deletes it when f returns */
+    Fiber* spawn(void (*f)(void*), void* arg = 0, size_t stack_size = 0);
+    void run();
+    static FiberScheduler* current(); /* null when not called from a scheduled fiber */
+    static void yield();
+    /* parks the current fiber until ready() or SystemTime::mono() >= deadline (deadline < 0
+       means infinite); unlock(arg) is called after the fiber is marked parked so ready()
+       issued right after it is not lost; returns false on timeout */
+    bool park(long long deadline, void (*unlock)(void*), void* arg);
+    static void ready(Fiber* fiber); /* may be called from any thread */
+private:
+    void enqueue(Fiber* fiber); /* under lock */
+    void expire(long long now); /* under lock */
+    void idleVirtual(long long deadline); /* under lock: sleeps until ready or virtual deadline */
+    static void alarm(void* p);
+    SRWLock lock;
+    ConditionVariable idle;
+    Fiber* head;   /* ready queue */
+    Fiber* tail;
+    Fiber* timers; /* parked fibers with deadline */
+    int live;
+    bool sleeping;
+    bool alarmed; /* virtual clock reached the deadline idleVirtual() waits for */
+    FiberScheduler(const FiberScheduler&); // not copyable
+    FiberScheduler& operator=(const FiberScheduler&);
+};
+
+#endif /* __FIBER_SCHEDULER_H__ */
@@ -0,0 +1,106 @@
+/*  Copyright (c) 2013, Leo Kuznetsov
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "Futex.h"
+#include "SystemTime.h"
+#include <assert.h>
+#include <errno.h>
+
+#ifdef WIN32
+#pragma warning(disable: 4820 4514 4668 4711)
+#include <Windows.h>
+#pragma comment(lib, "Synchronization.lib")
+
+int Futex::wait(volatile int* address, int expected, long long timeoutNanoseconds, bool shared) {
+    assert(!shared); // WaitOnAddress only works within a process
+    DWORD ms = timeoutNanoseconds < 0 ? INFINITE : (DWORD)(timeoutNanoseconds / NANOSECONDS_IN_MILLISECOND);
+    return ::WaitOnAddress(address, &expected, sizeof(int), ms) ? 0 : ETIMEDOUT;
+}
+
+void Futex::wake(volatile int* address, int count, bool) {
+    if (count == 1) {
+        ::WakeByAddressSingle((void*)address);
+    } else {
+        ::WakeByAddressAll((void*)address);
+    }
+}
+
+#elif defined(__linux__)
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+int Futex::wait(volatile int* address, int expected, long long timeoutNanoseconds, bool shared) {
+    struct timespec ts;
+    if (timeoutNanoseconds >= 0) {
+        SystemTime::toTimespec(ts, timeoutNanoseconds); // FUTEX_WAIT timeout is relative (CLOCK_MONOTONIC)
+    }
+    int op = shared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE;
+    int r = (int)syscall(SYS_futex, address, op, expected, timeoutNanoseconds >= 0 ? &ts : 0, 0, 0);
+    return r == 0 || errno != ETIMEDOUT ? 0 : ETIMEDOUT; // EAGAIN and EINTR are spurious wakeups
+}
+
+void Futex::wake(volatile int* address, int count, bool shared) {
+    syscall(SYS_futex, address, shared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE, count, 0, 0, 0);
+}
+
+#elif defined(__MACH__)
+
+#include <stdint.h>
+
+// see: https://opensource.apple.com/source/xnu/xnu-3789.1.32/bsd/sys/ulock.h
+extern "C" int __ulock_wait(uint32_t operation, void* address, uint64_t value, uint32_t timeout_us);
+extern "C" int __ulock_wake(uint32_t operation, void* address, uint64_t wake_value);
+
+enum {
+    UL_COMPARE_AND_WAIT = 1,
+    UL_COMPARE_AND_WAIT_SHARED = 3,
+    ULF_WAKE_ALL = 0x00000100,
+    ULF_NO_ERRNO = 0x01000000
+};
+
+int Futex::wait(volatile int* address, int expected, long long timeoutNanoseconds, bool shared) {
+    uint32_t us = 0; // zero means infinite for __ulock_wait
+    if (timeoutNanoseconds >= 0) {
+        long long t = timeoutNanoseconds / NANOSECONDS_IN_MICROSECOND;
+        us = t <= 0 ? 1 : t > 0xFFFFFFFFLL ? 0xFFFFFFFF : (uint32_t)t;
+    }
+    uint32_t op = (shared ? UL_COMPARE_AND_WAIT_SHARED : UL_COMPARE_AND_WAIT) | ULF_NO_ERRNO;
+    int r = __ulock_wait(op, (void*)address, (uint64_t)(uint32_t)expected, us);
+    return r == -ETIMEDOUT ? ETIMEDOUT : 0;
+}
+
+void Futex::wake(volatile int* address, int count, bool shared) {
+    uint32_t op = (shared ? UL_COMPARE_AND_WAIT_SHARED : UL_COMPARE_AND_WAIT) | ULF_NO_ERRNO;
+    __ulock_wake(count == 1 ? op : op | ULF_WAKE_ALL, (void*)address, 0);
+}
+
+#else
+#error "Futex: not implemented for this platform"
+#endif
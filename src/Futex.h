@@ -0,0 +1,49 @@
+/*  Copyright (c) 2013, Leo Kuznetsov
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+#ifndef __FUTEX_H__
+#define __FUTEX_H__
+
+/* Minimal "wait on address" primitive the synchronization classes are built on:
+   Linux futex(2), Mach __ulock_wait/__ulock_wake, Win32 WaitOnAddress (Windows 8 and higher).
+   shared == true is required for addresses in memory mapped by more than one process
+   (not supported by WaitOnAddress on Win32). */
+
+class Futex {
+public:
+    /* blocks while *address == expected; returns 0 on wakeup (spurious wakeups are possible)
+       or ETIMEDOUT, timeoutNanoseconds < 0 means infinite */
+    static int wait(volatile int* address, int expected, long long timeoutNanoseconds = -1, bool shared = false);
+    static void wake(volatile int* address, int count, bool shared = false);
+    static inline void wakeAll(volatile int* address, bool shared = false) { wake(address, 0x7FFFFFFF, shared); }
+private:
+    Futex() { /* do not instantiate */ }
+};
+
+#endif /* __FUTEX_H__ */
@@ -0,0 +1,100 @@
+/*  Copyright (c) 2013, Leo Kuznetsov
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "Future.h"
+#include "Atomic.h"
+#include <assert.h>
+
+#define null NULL
+
+#ifdef WIN32
+#pragma warning(disable: 4820 4514 4668 4711)
+#endif
+
+struct FutureState::Continuation {
+    ThreadPool* pool;
+    void (*f)(void*);
+    void* arg;
+    Continuation* next;
+};
+
+FutureState::FutureState() : ready(true, false), continuations(null), done(false), refs(1) {
+}
+
+FutureState::~FutureState() {
+    assert(continuations == null);
+}
+
+void FutureState::retain() {
+    Atomic::add(&refs, 1);
+}
+
+void FutureState::release() {
+    if (Atomic::add(&refs, -1) == 0) {
+        delete this;
+    }
+}
+
+void FutureState::complete() {
+    ready.set(); // first: continuations added from now on find the value ready
+    lock.acquireExclusive();
+    assert(!done); // Promise::set() called twice
+    done = true;
+    Continuation* lifo = continuations;
+    continuations = null;
+    lock.releaseExclusive();
+    Continuation* c = null;
+    while (lifo != null) { // submitted in the order then() was called
+        Continuation* next = lifo->next;
+        lifo->next = c;
+        c = lifo;
+        lifo = next;
+    }
+    while (c != null) {
+        Continuation* next = c->next;
+        c->pool->submit(c->f, c->arg);
+        delete c;
+        c = next;
+    }
+}
+
+void FutureState::continueWith(ThreadPool& pool, void (*f)(void*), void* arg) {
+    lock.acquireExclusive();
+    if (!done) {
+        Continuation* c = new Continuation;
+        c->pool = &pool;
+        c->f = f;
+        c->arg = arg;
+        c->next = continuations;
+        continuations = c;
+        lock.releaseExclusive();
+        return;
+    }
+    lock.releaseExclusive();
+    pool.submit(f, arg);
+}
@@ -0,0 +1,149 @@
+/*  Copyright (c) 2013, Leo Kuznetsov
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+#ifndef __FUTURE_H__
+#define __FUTURE_H__
+
+#include "Event.h"
+#include "SRWLock.h"
+#include "ThreadPool.h"
+
+/* Future<T> is the read side of a value Promise<T>::set() provides once. It can be waited
+   for with a timeout, together with other events (Event::waitAny(..., future.event())) or
+   not at all: then() submits the continuation to a ThreadPool only when the value is ready,
+   so chained stages never hold a thread blocked on their input. Both are reference counted
+   handles to one shared state and may be copied freely; T must be default constructible
+   and copyable. async() runs a function on a pool and is the Future of its result. */
+
+class FutureState { // value independent part of the shared state
+protected:
+    struct Continuation;
+    FutureState();
+    virtual ~FutureState();
+    void retain();
+    void release();
+    void complete(); /* value is stored: releases waiters and submits continuations */
+    void continueWith(ThreadPool& pool, void (*f)(void*), void* arg);
+    Event ready; // manual-reset
+private:
+    SRWLock lock;
+    Continuation* continuations; // LIFO
+    bool done;
+    volatile int refs;
+    FutureState(const FutureState&); // not copyable
+    FutureState& operator=(const FutureState&);
+    template <class T> friend class Future;
+    template <class T> friend class Promise;
+};
+
+template <class T> class Promise;
+
+template <class T>
+class Future {
+public:
+    Future(const Future& f) : state(f.state) { state->retain(); }
+    Future& operator=(const Future& f) { f.state->retain(); state->release(); state = f.state; return *this; }
+    ~Future() { state->release(); }
+    /* returns EVENT_WAIT_OBJECT_0 or EVENT_WAIT_TIMEOUT */
+    int wait(long long timeoutNanoseconds = EVENT_INFINITE) { return state->ready.wait(timeoutNanoseconds); }
+    bool isReady() { return state->ready.wait(0) == EVENT_WAIT_OBJECT_0; }
+    const T& get() { state->ready.wait(); return state->value; }
+    /* manual-reset Event signaled with the value: never set() or reset() it */
+    Event& event() { return state->ready; }
+    /* f(value, arg) runs on the pool once the value is ready; its result is the returned Future */
+    template <class R> Future<R> then(ThreadPool& pool, R (*f)(const T&, void*), void* arg = 0);
+private:
+    struct State : FutureState {
+        T value;
+    };
+    explicit Future(State* s) : state(s) { state->retain(); }
+    State* state;
+    template <class U> friend class Future;
+    friend class Promise<T>;
+};
+
+template <class T>
+class Promise {
+public:
+    Promise() : state(new typename Future<T>::State()) { }
+    Promise(const Promise& p) : state(p.state) { state->retain(); }
+    Promise& operator=(const Promise& p) { p.state->retain(); state->release(); state = p.state; return *this; }
+    ~Promise() { state->release(); }
+    Future<T> future() { return Future<T>(state); }
+    /* at most once */
+    void set(const T& value) { state->value = value; state->complete(); }
+private:
+    typename Future<T>::State* state;
+};
+
+template <class T, class R>
+struct FutureThen {
+    Future<T> source;
+    Promise<R> target;
+    R (*f)(const T&, void*);
+    void* arg;
+    FutureThen(const Future<T>& s, R (*fn)(const T&, void*), void* a) : source(s), f(fn), arg(a) { }
+    static void run(void* p) {
+        FutureThen* t = (FutureThen*)p;
+        t->target.set(t->f(t->source.get(), t->arg)); // ready: get() does not block
+        delete t;
+    }
+};
+
+template <class T> template <class R>
+Future<R> Future<T>::then(ThreadPool& pool, R (*f)(const T&, void*), void* arg) {
+    FutureThen<T, R>* t = new FutureThen<T, R>(*this, f, arg);
+    Future<R> r = t->target.future();
+    state->continueWith(pool, FutureThen<T, R>::run, t);
+    return r;
+}
+
+template <class T>
+struct FutureAsync {
+    Promise<T> promise;
+    T (*f)(void*);
+    void* arg;
+    static void run(void* p) {
+        FutureAsync* a = (FutureAsync*)p;
+        a->promise.set(a->f(a->arg));
+        delete a;
+    }
+};
+
+template <class T>
+Future<T> async(ThreadPool& pool, T (*f)(void*), void* arg = 0) {
+    FutureAsync<T>* a = new FutureAsync<T>;
+    a->f = f;
+    a->arg = arg;
+    Future<T> r = a->promise.future();
+    pool.submit(FutureAsync<T>::run, a);
+    return r;
+}
+
+#endif /* __FUTURE_H__ */
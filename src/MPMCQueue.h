@@ -0,0 +1,162 @@
+/*  Copyright (c) 2013, Leo Kuznetsov
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+#ifndef __MPMC_QUEUE_H__
+#define __MPMC_QUEUE_H__
+
+#include "EventCount.h"
+#include "Event.h"
+#include "Atomic.h"
+#include "SystemTime.h"
+
+/* Bounded lock-free multi-producer multi-consumer queue (Dmitry Vyukov): every cell has a
+   sequence number telling producers and consumers whose turn it is, so a push or pop is
+   one compare-exchange on the shared position plus one store. push() and pop() sleep on
+   EventCounts when the queue is full or empty; tryPush() and tryPop() wake them, with
+   nobody sleeping that is one load (the cell's sequence store is sequentially consistent
+   and orders it, no fence). T must be default constructible and copyable. */
+
+template <class T>
+class MPMCQueue {
+public:
+    /* capacity is rounded up to a power of 2 */
+    explicit MPMCQueue(int capacity);
+    virtual ~MPMCQueue() { delete[] cells; }
+    bool tryPush(const T& v);
+    bool tryPop(T& v);
+    void push(const T& v); /* waits while full */
+    /* waits while empty, returns false on timeout; timeoutNanoseconds < 0 means infinite */
+    bool pop(T& v, long long timeoutNanoseconds = -1);
+private:
+    enum { CACHE_LINE = 64 };
+    struct Cell {
+        volatile long long sequence;
+        T data;
+    };
+    Cell* cells;
+    long long mask;
+    char padding0[CACHE_LINE];
+    volatile long long head; // next push position
+    char padding1[CACHE_LINE - sizeof(long long)];
+    volatile long long tail; // next pop position
+    char padding2[CACHE_LINE - sizeof(long long)];
+    EventCount not_empty;
+    EventCount not_full;
+    MPMCQueue(const MPMCQueue&); // not copyable
+    MPMCQueue& operator=(const MPMCQueue&);
+};
+
+template <class T>
+MPMCQueue<T>::MPMCQueue(int capacity) : head(0), tail(0) {
+    int n = 2;
+    while (n < capacity) { n *= 2; }
+    cells = new Cell[n];
+    mask = n - 1;
+    for (int i = 0; i < n; i++) { cells[i].sequence = i; }
+}
+
+template <class T>
+bool MPMCQueue<T>::tryPush(const T& v) {
+    long long pos = Atomic::load(&head);
+    for (;;) {
+        Cell& c = cells[pos & mask];
+        long long d = Atomic::load(&c.sequence) - pos;
+        if (d == 0) { // cell is free for pos
+            if (Atomic::compareExchange(&head, pos, pos + 1)) {
+                c.data = v;
+                Atomic::store(&c.sequence, pos + 1);
+                not_empty.notify();
+                return true;
+            }
+            pos = Atomic::load(&head);
+        } else if (d < 0) { // cell still holds the value pushed a lap ago: full
+            return false;
+        } else {
+            pos = Atomic::load(&head);
+        }
+    }
+}
+
+template <class T>
+bool MPMCQueue<T>::tryPop(T& v) {
+    long long pos = Atomic::load(&tail);
+    for (;;) {
+        Cell& c = cells[pos & mask];
+        long long d = Atomic::load(&c.sequence) - (pos + 1);
+        if (d == 0) { // value for pos is there
+            if (Atomic::compareExchange(&tail, pos, pos + 1)) {
+                v = c.data;
+                Atomic::store(&c.sequence, pos + mask + 1);
+                not_full.notify();
+                return true;
+            }
+            pos = Atomic::load(&tail);
+        } else if (d < 0) { // empty
+            return false;
+        } else {
+            pos = Atomic::load(&tail);
+        }
+    }
+}
+
+template <class T>
+void MPMCQueue<T>::push(const T& v) {
+    while (!tryPush(v)) {
+        EventCount::Key key = not_full.prepareWait();
+        if (tryPush(v)) {
+            not_full.cancelWait();
+            return;
+        }
+        not_full.commitWait(key);
+    }
+}
+
+template <class T>
+bool MPMCQueue<T>::pop(T& v, long long timeoutNanoseconds) {
+    long long deadline = timeoutNanoseconds < 0 ? -1 : SystemTime::mono() + timeoutNanoseconds;
+    while (!tryPop(v)) {
+        EventCount::Key key = not_empty.prepareWait();
+        if (tryPop(v)) {
+            not_empty.cancelWait();
+            return true;
+        }
+        long long timeout = -1;
+        if (deadline >= 0) {
+            timeout = deadline - SystemTime::mono();
+            if (timeout <= 0) {
+                not_empty.cancelWait();
+                return false;
+            }
+        }
+        not_empty.commitWait(key, timeout);
+    }
+    return true;
+}
+
+#endif /* __MPMC_QUEUE_H__ */
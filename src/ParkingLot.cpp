@@ -0,0 +1,226 @@
+/*  Copyright (c) 2013, Leo Kuznetsov
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "ParkingLot.h"
+#include "SRWLock.h"
+#include "Futex.h"
+#include "Atomic.h"
+#include "SystemTime.h"
+#include "Thread.h"
+#include <assert.h>
+#include <string.h>
+#include <errno.h>
+
+#define null NULL
+
+#ifdef WIN32
+#pragma warning(disable: 4820 4514 4668 4711)
+#endif
+
+struct Parked { // lives on the stack of the parked thread
+    const void* address;
+    Parked* next;
+    volatile int parked; // futex: 1 while queued, 2 queued and virtual timeout expired, 0 unparked
+};
+
+enum { BUCKETS = 1024, CACHE_LINE = 64 }; // power of 2
+
+struct Bucket {
+    SRWLock lock;
+    Parked* head; // FIFO
+    Parked* tail;
+    char padding[CACHE_LINE - sizeof(SRWLock) - 2 * sizeof(Parked*)];
+};
+
+static Bucket buckets[BUCKETS];
+
+static Bucket& bucket(const void* address) {
+    unsigned long long h = (unsigned long long)address;
+    h ^= h >> 33; // 64 bit finalizer of MurmurHash3: neighbouring objects land in different buckets
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return buckets[h & (BUCKETS - 1)];
+}
+
+static bool dequeue(Bucket& b, Parked* p) { // under b.lock
+    Parked* prev = null;
+    for (Parked* q = b.head; q != null; prev = q, q = q->next) {
+        if (q == p) {
+            if (prev != null) { prev->next = q->next; } else { b.head = q->next; }
+            if (b.tail == q) { b.tail = prev; }
+            return true;
+        }
+    }
+    return false;
+}
+
+static void wake(Parked* p) { // after b.lock is released: p is gone as soon as parked == 0
+    Atomic::store(&p->parked, 0);
+    Futex::wake(&p->parked, 1);
+}
+
+static void virtualTimeout(void* p) { // virtual clock timer: the waiter dequeues itself
+    Parked* self = (Parked*)p;
+    if (Atomic::compareExchange(&self->parked, 1, 2)) {
+        Futex::wake(&self->parked, 1);
+    }
+}
+
+int ParkingLot::park(const void* address, bool (*validate)(void*), void* context, long long timeoutNanoseconds) {
+    Bucket& b = bucket(address);
+    Parked self;
+    self.address = address;
+    self.next = null;
+    self.parked = 1;
+    b.lock.acquireExclusive();
+    if (validate != null && !validate(context)) {
+        b.lock.releaseExclusive();
+        return PARK_INVALID;
+    }
+    if (b.tail != null) { b.tail->next = &self; } else { b.head = &self; }
+    b.tail = &self;
+    b.lock.releaseExclusive();
+    long long deadline = timeoutNanoseconds < 0 ? 0 : SystemTime::mono() + timeoutNanoseconds;
+    bool virtual_time = timeoutNanoseconds >= 0 && SystemTime::isVirtual();
+    SystemTime::Timer timer = { deadline, virtualTimeout, &self, null };
+    if (virtual_time) {
+        SystemTime::addTimer(&timer);
+    }
+    Thread::blockBegin(); // queued: validate() == false returned above without blocking
+    int r = PARK_UNPARKED;
+    for (;;) {
+        int s = Atomic::load(&self.parked);
+        if (s == 0) {
+            break;
+        }
+        long long timeout = -1;
+        bool expired = s == 2;
+        if (timeoutNanoseconds >= 0 && !virtual_time) {
+            timeout = deadline - SystemTime::mono();
+            expired = timeout <= 0;
+        }
+        if (expired) {
+            b.lock.acquireExclusive();
+            bool queued = dequeue(b, &self);
+            b.lock.releaseExclusive();
+            if (queued) {
+                r = PARK_TIMEOUT;
+                break;
+            }
+            while (Atomic::load(&self.parked) != 0) { // being unparked right now: wait for wake()
+                Futex::wait(&self.parked, s);
+            }
+            break;
+        }
+        Futex::wait(&self.parked, s, timeout);
+    }
+    Thread::blockEnd();
+    if (virtual_time) {
+        SystemTime::removeTimer(&timer); // waits for virtualTimeout() to return
+    }
+    return r;
+}
+
+int ParkingLot::unparkOne(const void* address, void (*callback)(void*, bool, bool), void* context) {
+    Bucket& b = bucket(address);
+    b.lock.acquireExclusive();
+    Parked* found = null;
+    Parked* prev = null;
+    for (Parked* q = b.head; q != null; prev = q, q = q->next) {
+        if (q->address == address) {
+            found = q;
+            if (prev != null) { prev->next = q->next; } else { b.head = q->next; }
+            if (b.tail == q) { b.tail = prev; }
+            break;
+        }
+    }
+    if (callback != null) {
+        bool has_more = false;
+        for (Parked* q = found != null ? found->next : b.head; q != null && !has_more; q = q->next) {
+            has_more = q->address == address;
+        }
+        callback(context, found != null, has_more);
+    }
+    b.lock.releaseExclusive();
+    if (found != null) {
+        wake(found);
+    }
+    return found != null;
+}
+
+int ParkingLot::unparkAll(const void* address) {
+    Bucket& b = bucket(address);
+    Parked* woken = null; // detached under the lock, woken after releasing it
+    b.lock.acquireExclusive();
+    Parked* prev = null;
+    Parked* q = b.head;
+    while (q != null) {
+        Parked* next = q->next;
+        if (q->address == address) {
+            if (prev != null) { prev->next = next; } else { b.head = next; }
+            if (b.tail == q) { b.tail = prev; }
+            q->next = woken;
+            woken = q;
+        } else {
+            prev = q;
+        }
+        q = next;
+    }
+    b.lock.releaseExclusive();
+    int n = 0;
+    while (woken != null) {
+        Parked* next = woken->next;
+        wake(woken);
+        woken = next;
+        n++;
+    }
+    return n;
+}
+
+struct Compare {
+    const volatile void* address;
+    const void* compare;
+    int size;
+};
+
+static bool equal(void* p) {
+    Compare& c = *(Compare*)p;
+    switch (c.size) {
+        case 1: return *(const volatile unsigned char*)c.address == *(const unsigned char*)c.compare;
+        case 2: return *(const volatile unsigned short*)c.address == *(const unsigned short*)c.compare;
+        case 4: return *(const volatile unsigned int*)c.address == *(const unsigned int*)c.compare;
+        case 8: return *(const volatile unsigned long long*)c.address == *(const unsigned long long*)c.compare;
+        default: assert(false); return false;
+    }
+}
+
+bool ParkingLot::waitOnAddress(const volatile void* address, const void* compare, int size, long long timeoutNanoseconds) {
+    Compare c = {address, compare, size};
+    int r = park((const void*)address, equal, &c, timeoutNanoseconds);
+    return r != PARK_TIMEOUT;
+}
@@ -0,0 +1,65 @@
+/*  Copyright (c) 2013, Leo Kuznetsov
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+#ifndef __PARKING_LOT_H__
+#define __PARKING_LOT_H__
+
+enum { /* ParkingLot::park() result */
+    PARK_UNPARKED = 0,
+    PARK_INVALID = 1, /* validate() returned false: did not sleep */
+    PARK_TIMEOUT = 2
+};
+
+/* Global hashed table of waiter queues keyed by address (WebKit ParkingLot, Win32
+   WaitOnAddress/WakeByAddressSingle): objects keep only their state bits and threads
+   queue here while they sleep. validate() and unparkOne() callback run under the
+   lock of the address's bucket so a state change made in one is ordered with the other.
+   Parking blocks the calling thread (including fibers scheduled on it); only a thread that
+   actually queued counts as blocked (Thread::blockBegin()). */
+
+class ParkingLot {
+public:
+    /* queues the calling thread on address if validate(context) returns true
+       (validate == null means true) and sleeps until unparked or timeout */
+    static int park(const void* address, bool (*validate)(void* context), void* context,
+                    long long timeoutNanoseconds = -1);
+    /* wakes the longest parked thread; callback(context, unparked, has_more) is called under
+       the bucket lock whether or not a thread was found; returns number of threads woken */
+    static int unparkOne(const void* address, void (*callback)(void* context, bool unparked, bool has_more) = 0,
+                         void* context = 0);
+    static int unparkAll(const void* address);
+    /* WaitOnAddress: sleeps while the size (1, 2, 4 or 8) bytes at address equal compare;
+       returns false on timeout. Wake with unparkOne/unparkAll (WakeByAddressSingle/All) */
+    static bool waitOnAddress(const volatile void* address, const void* compare, int size,
+                              long long timeoutNanoseconds = -1);
+private:
+    ParkingLot() { /* do not instantiate */ }
+};
+
+#endif /* __PARKING_LOT_H__ */
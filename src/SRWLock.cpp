@@ -0,0 +1,156 @@
+/*  Copyright (c) 2013, Leo Kuznetsov
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "SRWLock.h"
+#include "Futex.h"
+#include "Atomic.h"
+
+#ifdef WIN32
+#pragma warning(disable: 4820 4514 4668 4711)
+#include <Windows.h>
+
+SRWLock::SRWLock() {
+    ::InitializeSRWLock((PSRWLOCK)&lock);
+}
+
+void SRWLock::acquireExclusive() {
+    ::AcquireSRWLockExclusive((PSRWLOCK)&lock);
+}
+
+void SRWLock::releaseExclusive() {
+    ::ReleaseSRWLockExclusive((PSRWLOCK)&lock);
+}
+
+void SRWLock::acquireShared() {
+    ::AcquireSRWLockShared((PSRWLOCK)&lock);
+}
+
+void SRWLock::releaseShared() {
+    ::ReleaseSRWLockShared((PSRWLOCK)&lock);
+}
+
+bool SRWLock::tryAcquireExclusive() {
+    return ::TryAcquireSRWLockExclusive((PSRWLOCK)&lock) != 0;
+}
+
+bool SRWLock::tryAcquireShared() {
+    return ::TryAcquireSRWLockShared((PSRWLOCK)&lock) != 0;
+}
+
+#else
+
+enum {
+    WRITER  = 1,
+    WAITING = 2, // at least one thread is (about to be) sleeping on seq
+    READER  = 4,
+    SPIN    = 64
+};
+
+SRWLock::SRWLock() : state(0), seq(0) {
+}
+
+bool SRWLock::tryAcquireExclusive() {
+    int s = __atomic_load_n(&state, __ATOMIC_RELAXED);
+    return (s & ~WAITING) == 0 &&
+        __atomic_compare_exchange_n(&state, &s, s | WRITER, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+bool SRWLock::tryAcquireShared() {
+    int s = __atomic_load_n(&state, __ATOMIC_RELAXED);
+    return (s & (WRITER | WAITING)) == 0 &&
+        __atomic_compare_exchange_n(&state, &s, s + READER, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+/* acquire starts from a guess of the unlocked state: uncontended it is a single CAS with no
+   load before it; a failed CAS returns the actual state to decide on without loading again */
+
+void SRWLock::acquireExclusive() {
+    int s = 0;
+    for (int spin = 0; ; spin++) {
+        if ((s & ~WAITING) == 0) {
+            if (__atomic_compare_exchange_n(&state, &s, s | WRITER, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                return;
+            }
+            continue;
+        } else if (spin < SPIN) {
+            Atomic::pause();
+        } else {
+            sleep(s);
+        }
+        s = __atomic_load_n(&state, __ATOMIC_RELAXED);
+    }
+}
+
+void SRWLock::acquireShared() {
+    int s = 0;
+    for (int spin = 0; ; spin++) {
+        if ((s & (WRITER | WAITING)) == 0) {
+            if (__atomic_compare_exchange_n(&state, &s, s + READER, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                return;
+            }
+            continue;
+        } else if (spin < SPIN) {
+            Atomic::pause();
+        } else {
+            sleep(s);
+        }
+        s = __atomic_load_n(&state, __ATOMIC_RELAXED);
+    }
+}
+
+void SRWLock::releaseExclusive() {
+    int s = __atomic_exchange_n(&state, 0, __ATOMIC_RELEASE);
+    if (s & WAITING) {
+        wakeAll();
+    }
+}
+
+void SRWLock::releaseShared() {
+    int s = __atomic_sub_fetch(&state, READER, __ATOMIC_RELEASE);
+    if (s == WAITING && __atomic_compare_exchange_n(&state, &s, 0, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        wakeAll(); // last reader out
+    }
+}
+
+void SRWLock::sleep(int s) { // s: locked state observed by the caller
+    if ((s & WAITING) == 0 &&
+        !__atomic_compare_exchange_n(&state, &s, s | WAITING, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return; // state has changed, caller will retry
+    }
+    int q = __atomic_load_n(&seq, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&state, __ATOMIC_SEQ_CST) & WAITING) {
+        Futex::wait(&seq, q);
+    }
+}
+
+void SRWLock::wakeAll() {
+    __atomic_add_fetch(&seq, 1, __ATOMIC_SEQ_CST);
+    Futex::wakeAll(&seq);
+}
+
+#endif
@@ -0,0 +1,61 @@
+/*  Copyright (c) 2013, Leo Kuznetsov
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+#ifndef __SRWLOCK_H__
+#define __SRWLOCK_H__
+
+/* Slim reader/writer lock a.k.a. Win32 SRWLOCK: pointer sized, not recursive, no ownership.
+   Uncontended acquire and release are a single atomic operation each;
+   contended threads spin shortly and then sleep on a futex.
+   New readers yield to sleeping writers so read-mostly workloads do not starve them. */
+
+class SRWLock {
+public:
+    SRWLock();
+    void acquireExclusive();
+    void releaseExclusive();
+    void acquireShared();
+    void releaseShared();
+    bool tryAcquireExclusive();
+    bool tryAcquireShared();
+private:
+    friend class ConditionVariable;
+#ifdef WIN32
+    void* lock; // SRWLOCK
+#else
+    void sleep(int s);
+    void wakeAll();
+    volatile int state; // WRITER | WAITING | readers * READER
+    volatile int seq;   // futex: incremented when sleepers need to re-check the state
+#endif
+    SRWLock(const SRWLock&);            // not copyable
+    SRWLock& operator=(const SRWLock&);
+};
+
+#endif /* __SRWLOCK_H__ */
@@ -27,6 +27,10 @@
  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include "SystemTime.h"
+#include "SRWLock.h"
+#include "Futex.h"
+#include "Atomic.h"
+#include "Thread.h"
 #include <assert.h>
 
 #ifdef WIN32
@@ -37,7 +41,7 @@
 
 static const unsigned long long TIMESPAN1601TO1970IN100NS = 0x019db1de019db1deLL; /* 116444732449468894LL */
 
-void SystemTime::wallTimespec(struct timespec &ts) {
+void SystemTime::realWallTimespec(struct timespec &ts) {
     ::FILETIME ft;
     ::GetSystemTimeAsFileTime(&ft);
     // TODO: GetSystemTimePreciseAsFileTime for Win8 & WinServer 2012 and higher
@@ -53,21 +57,22 @@ unsigned long long SystemTime::toWin100nsSystemTime(long long nanesecodns) {
     return (unsigned long long)(nanesecodns / 100U + TIMESPAN1601TO1970IN100NS);
 }
 
-void SystemTime::monoTimespec(struct timespec &ts) {
-    wallTimespec(ts);
+void SystemTime::realMonoTimespec(struct timespec &ts) {
+    realWallTimespec(ts);
 }
 
 void SystemTime::cpuTimespec(struct timespec &ts) {
-    wallTimespec(ts);
+    realWallTimespec(ts);
 }
 
-void SystemTime::sleep(long long timeoutNanoseconds) {
+void SystemTime::realSleep(long long timeoutNanoseconds) {
     ::Sleep((DWORD)(timeoutNanoseconds / NANOSECONDS_IN_MILLISECOND));
 }
 
 #else
 
 #include <sys/time.h>
+#include <pthread.h>
 
 #ifdef __MACH__
 
@@ -82,7 +87,7 @@ static void mach_clock_get_thread_time(struct timespec* tm);
 
 // see: http://stackoverflow.com/questions/14270300/what-is-the-difference-between-clock-monotonic-clock-monotonic-raw
 
-void SystemTime::wallTimespec(struct timespec &ts) {
+void SystemTime::realWallTimespec(struct timespec &ts) {
 #if defined(__ANDROID__) && defined(CLOCK_REALTIME_HR)
     clock_gettime(CLOCK_REALTIME_HR, &ts);
 #elif defined(CLOCK_REALTIME)
@@ -96,13 +101,13 @@ void SystemTime::wallTimespec(struct timespec &ts) {
 #endif
 }
 
-void SystemTime::monoTimespec(struct timespec &ts) {
+void SystemTime::realMonoTimespec(struct timespec &ts) {
 #if defined(CLOCK_MONOTONIC)
     clock_gettime(CLOCK_MONOTONIC, &ts);
 #elif defined(__MACH__)
     mach_clock_gettime(&ts);
 #else
-    wallTimespec(ts);
+    realWallTimespec(ts);
 #endif
 }
 
@@ -118,7 +123,7 @@ void SystemTime::cpuTimespec(struct timespec &ts) {
 #endif
 }
 
-void SystemTime::sleep(long long nanoseconds) {
+void SystemTime::realSleep(long long nanoseconds) {
     struct timespec rq = { (long)(nanoseconds / NANOSECONDS_IN_SECOND), (long)(nanoseconds % NANOSECONDS_IN_SECOND) };
     struct timespec rm = { 0, 0 };
     nanosleep(&rq, &rm);
@@ -157,4 +162,182 @@ static void mach_clock_get_thread_time(struct timespec* tm) {
 
 #endif
 
-#endif // WIN32
\ No newline at end of file
+#endif // WIN32
+
+/* Virtual clock: "now" is mono() time; wall() keeps the offset it had when enabled.
+   Timers are an unsorted list: tests have a handful of timed waits at a time. */
+
+static volatile int virtual_enabled;
+static bool virtual_auto;
+static volatile int virtual_stop;
+static volatile long long virtual_now;
+static long long virtual_wall_offset;
+static SRWLock virtual_lock;
+static SystemTime::Timer* virtual_timers;
+static volatile int running = 1;  // main thread: Thread and Thread::blockBegin() add and subtract
+static volatile int activity;     // incremented by every runnable() change
+#ifdef WIN32
+static HANDLE virtual_thread;
+#else
+static pthread_t virtual_thread;
+#endif
+
+void SystemTime::wallTimespec(struct timespec &ts) {
+    if (Atomic::load(&virtual_enabled)) {
+        toTimespec(ts, Atomic::load(&virtual_now) + virtual_wall_offset);
+    } else {
+        realWallTimespec(ts);
+    }
+}
+
+void SystemTime::monoTimespec(struct timespec &ts) {
+    if (Atomic::load(&virtual_enabled)) {
+        toTimespec(ts, Atomic::load(&virtual_now));
+    } else {
+        realMonoTimespec(ts);
+    }
+}
+
+static void wakeSleeper(void* p) {
+    Atomic::store((volatile int*)p, 1);
+    Futex::wake((volatile int*)p, 1);
+}
+
+void SystemTime::sleep(long long nanoseconds) {
+    if (!Atomic::load(&virtual_enabled) || nanoseconds <= 0) {
+        realSleep(nanoseconds);
+        return;
+    }
+    volatile int woken = 0;
+    Timer t = { mono() + nanoseconds, wakeSleeper, (void*)&woken, 0 };
+    addTimer(&t);
+    Thread::blockBegin();
+    while (!Atomic::load(&woken)) {
+        Futex::wait(&woken, 0);
+    }
+    Thread::blockEnd();
+    removeTimer(&t); // waits for wakeSleeper() to return
+}
+
+bool SystemTime::isVirtual() {
+    return Atomic::load(&virtual_enabled) != 0;
+}
+
+void SystemTime::runnable(int delta) {
+    Atomic::add(&running, delta);
+    Atomic::add(&activity, 1);
+}
+
+void SystemTime::addTimer(Timer* t) {
+    virtual_lock.acquireExclusive();
+    t->next = virtual_timers;
+    virtual_timers = t;
+    bool expired = t->deadline <= Atomic::load(&virtual_now);
+    virtual_lock.releaseExclusive();
+    if (expired) {
+        advanceTo(t->deadline); // fires it
+    }
+}
+
+void SystemTime::removeTimer(Timer* t) {
+    virtual_lock.acquireExclusive();
+    for (Timer** p = &virtual_timers; *p != 0; p = &(*p)->next) {
+        if (*p == t) {
+            *p = t->next;
+            break;
+        }
+    }
+    virtual_lock.releaseExclusive();
+}
+
+void SystemTime::advanceTo(long long now) {
+    virtual_lock.acquireExclusive();
+    if (now > Atomic::load(&virtual_now)) {
+        Atomic::store(&virtual_now, now);
+    }
+    now = Atomic::load(&virtual_now);
+    Timer** p = &virtual_timers;
+    while (*p != 0) {
+        Timer* t = *p;
+        if (t->deadline <= now) {
+            *p = t->next;
+            t->fire(t->arg);
+        } else {
+            p = &t->next;
+        }
+    }
+    virtual_lock.releaseExclusive();
+}
+
+void SystemTime::advance(long long nanoseconds) {
+    assert(isVirtual());
+    advanceTo(Atomic::load(&virtual_now) + nanoseconds);
+}
+
+/* auto advance: the clock moves only when no counted thread is runnable and nothing
+   changed for a short real time window (a woken thread may not have counted itself yet) */
+
+enum { QUIESCENT = 200 * NANOSECONDS_IN_MICROSECOND };
+
+#ifdef WIN32
+unsigned long __stdcall SystemTime::clockThread(void*) {
+#else
+void* SystemTime::clockThread(void*) {
+#endif
+    while (!Atomic::load(&virtual_stop)) {
+        realSleep(QUIESCENT / 4);
+        if (Atomic::load(&running) > 0) {
+            continue;
+        }
+        int a = Atomic::load(&activity);
+        realSleep(QUIESCENT);
+        if (Atomic::load(&running) > 0 || Atomic::load(&activity) != a) {
+            continue;
+        }
+        virtual_lock.acquireExclusive();
+        long long next = -1;
+        for (Timer* t = virtual_timers; t != 0; t = t->next) {
+            next = next < 0 || t->deadline < next ? t->deadline : next;
+        }
+        virtual_lock.releaseExclusive();
+        if (next >= 0) {
+            advanceTo(next);
+        }
+    }
+    return 0;
+}
+
+void SystemTime::virtualClock(bool enable, bool auto_advance) {
+    if (enable == isVirtual()) {
+        return;
+    }
+    if (enable) {
+        struct timespec mono, wall;
+        realMonoTimespec(mono);
+        realWallTimespec(wall);
+        Atomic::store(&virtual_now, fromTimespec(mono));
+        virtual_wall_offset = fromTimespec(wall) - fromTimespec(mono);
+        virtual_auto = auto_advance;
+        Atomic::store(&virtual_stop, 0);
+        Atomic::store(&virtual_enabled, 1);
+        if (virtual_auto) {
+#ifdef WIN32
+            virtual_thread = ::CreateThread(0, 64 * 1024, clockThread, 0, 0, 0);
+#else
+            pthread_create(&virtual_thread, 0, clockThread, 0);
+#endif
+        }
+    } else {
+        if (virtual_auto) {
+            Atomic::store(&virtual_stop, 1);
+#ifdef WIN32
+            ::WaitForSingleObject(virtual_thread, INFINITE);
+            ::CloseHandle(virtual_thread);
+#else
+            pthread_join(virtual_thread, 0);
+#endif
+        }
+        assert(virtual_timers == 0); // timed waits in progress
+        Atomic::store(&virtual_enabled, 0);
+    }
+}
@@ -53,6 +53,9 @@ public:
     static inline long long mono() { struct timespec ts; monoTimespec(ts); return fromTimespec(ts); }
     static inline long long wall() { struct timespec ts; wallTimespec(ts); return fromTimespec(ts); }
     static inline long long cpu()  { struct timespec ts; cpuTimespec(ts); return fromTimespec(ts); }
+    /* CLOCK_MONOTONIC even while the virtual clock is on: measurements (Trace, ThreadTimes,
+       wake latency) and timeouts shared with other processes */
+    static inline long long realMono() { struct timespec ts; realMonoTimespec(ts); return fromTimespec(ts); }
     static void sleep(long long nanoseconds);
     static void wallTimespec(struct timespec &ts); /* a.k.a. CLOCK_REALTIME or better */
     static void monoTimespec(struct timespec &ts); /* a.k.a. CLOCK_MONOTONIC not affected by NTP adjustments */
@@ -65,7 +68,37 @@ public:
         return NANOSECONDS_IN_SECOND * (long long)ts.tv_sec + ts.tv_nsec;
     }
     static unsigned long long toWin100nsSystemTime(long long nanoseconds);
+
+    /* Virtual clock for tests: mono(), wall(), sleep() and the timeouts of process local
+       Event, CompactEvent, ParkingLot, EventCount, CompletionPort and FiberScheduler waits
+       follow a clock that only moves with advance() or, with auto_advance, jumps to the
+       nearest timer deadline once every counted thread is blocked (see Thread::blockBegin)
+       and stays so for a moment. Timeouts of named events, CountdownLatch, SRWLock and
+       ConditionVariable waits elapse in real time (realMono()). Switch only while no timed
+       wait or sleep is in progress. */
+    static void virtualClock(bool enable, bool auto_advance = true);
+    static bool isVirtual();
+    static void advance(long long nanoseconds);
+
+    struct Timer { /* fired once under the clock lock when virtual mono() reaches deadline */
+        long long deadline;
+        void (*fire)(void* arg);
+        void* arg;
+        Timer* next;
+    };
+    static void addTimer(Timer* t);
+    static void removeTimer(Timer* t); /* no-op if fired: fire() has returned when it returns */
+    static void runnable(int delta);   /* thread started/stopped running: +1/-1 */
 private:
+    static void realWallTimespec(struct timespec &ts);
+    static void realMonoTimespec(struct timespec &ts);
+    static void realSleep(long long nanoseconds);
+    static void advanceTo(long long mono);
+#ifdef WIN32
+    static unsigned long __stdcall clockThread(void*);
+#else
+    static void* clockThread(void*);
+#endif
     SystemTime() { /* do not instantiate */ }
 };
 
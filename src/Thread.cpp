@@ -27,22 +27,98 @@
  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include "Thread.h"
+#include "Event.h"
+#include "Atomic.h"
+#include "SystemTime.h"
+#include "Trace.h"
 #include "assert.h"
+#include <string.h>
 
 #ifdef WIN32
 #pragma warning(disable: 4820 4514 4668 4189 4711)
 #include <Windows.h>
 #include <process.h>
 
+typedef HRESULT (WINAPI *SetThreadDescription_f)(HANDLE, PCWSTR); // Windows 10 1607 and higher
+
+struct UserApc {
+    void (*f)(void*);
+    void* arg;
+};
+
+static __declspec(thread) Thread* current_thread;
+static __declspec(thread) void (*block_hook)(void*, bool);
+static __declspec(thread) void* block_hook_context;
+static __declspec(thread) bool block_counted;
+static DWORD main_thread = ::GetCurrentThreadId(); // static initializers run on the main thread
+
+static bool isMainThread() {
+    return ::GetCurrentThreadId() == main_thread;
+}
+
+static void __stdcall winApcProc(ULONG_PTR p) {
+    UserApc* apc = (UserApc*)p;
+    apc->f(apc->arg);
+    delete apc;
+}
+
 unsigned int __stdcall Thread::winThreadProc(void* p) {
     Thread & t = *(Thread*)p;
+    if (t.name[0] != 0) {
+        SetThreadDescription_f setThreadDescription = (SetThreadDescription_f)
+            ::GetProcAddress(::GetModuleHandleA("kernel32.dll"), "SetThreadDescription");
+        if (setThreadDescription != 0) {
+            wchar_t wide[sizeof(t.name)];
+            ::MultiByteToWideChar(CP_UTF8, 0, t.name, -1, wide, (int)(sizeof(wide) / sizeof(wide[0])));
+            setThreadDescription(::GetCurrentThread(), wide);
+        }
+    }
+    current_thread = &t;
+    MSG msg;
+    ::PeekMessageA(&msg, 0, WM_USER, WM_USER, PM_NOREMOVE); // creates the thread's message queue
+    t.os_id = (int)::GetCurrentThreadId();
+    Atomic::add(&t.started, SystemTime::realMono());
+    TRACE(TRACE_THREAD_START, &t);
     t.result = t.f(t.a);
+    TRACE(TRACE_THREAD_EXIT, &t);
+    t.finish();
     _endthreadex(0);
     return 0;
 }
 
 Thread::Thread(void* (*func)(void*), void* arg) : f(func), a(arg), done(false), exiting(false) {
-    thread = _beginthreadex(0, 0, Thread::winThreadProc, this, 0, 0);
+    start(ThreadOptions());
+}
+
+Thread::Thread(void* (*func)(void*), void* arg, const ThreadOptions& options) :
+    f(func), a(arg), done(false), exiting(false) {
+    start(options);
+}
+
+void Thread::start(const ThreadOptions& options) {
+    assert(options.stack == 0); // preallocated stacks are not supported by Win32 threads
+    strncpy(name, options.name != 0 ? options.name : "", sizeof(name) - 1);
+    name[sizeof(name) - 1] = 0;
+    os_id = 0;
+    started = 0;
+    sampled = 0;
+    blocked = 0;
+    block_begin = 0;
+    memset(&final, 0, sizeof(final));
+    nice_value = 0;
+    renice = false;
+    unsigned int flags = options.stack_size != 0 ? STACK_SIZE_PARAM_IS_A_RESERVATION | CREATE_SUSPENDED : CREATE_SUSPENDED;
+    SystemTime::runnable(+1); // counted from now on: the creator may block before the thread runs
+    thread = _beginthreadex(0, (unsigned int)options.stack_size, Thread::winThreadProc, this, flags, 0);
+    if (options.policy == THREAD_SCHED_FIFO || options.policy == THREAD_SCHED_RR) {
+        ::SetThreadPriority((HANDLE)thread, THREAD_PRIORITY_TIME_CRITICAL);
+    } else if (options.policy == THREAD_SCHED_OTHER && options.priority != 0) {
+        int p = options.priority < -10 ? THREAD_PRIORITY_HIGHEST :
+                options.priority < 0   ? THREAD_PRIORITY_ABOVE_NORMAL :
+                options.priority > 10  ? THREAD_PRIORITY_LOWEST : THREAD_PRIORITY_BELOW_NORMAL;
+        ::SetThreadPriority((HANDLE)thread, p);
+    }
+    ::ResumeThread((HANDLE)thread);
 }
 
 Thread::~Thread() {
@@ -55,7 +131,9 @@ void* Thread::join() {
     if (!done) {
         #pragma warning(suppress: 4365)
         assert(thread != (uintptr_t)0); // do not join twice
+        blockBegin();
         int r = (int)::WaitForSingleObject((HANDLE)thread, INFINITE);
+        blockEnd();
         ::CloseHandle((HANDLE)thread);
         thread = 0;
         done = true;
@@ -65,6 +143,63 @@ void* Thread::join() {
     return result;
 }
 
+bool Thread::queueApc(void (*f)(void*), void* arg) {
+    UserApc* apc = new UserApc;
+    apc->f = f;
+    apc->arg = arg;
+    bool queued = !exiting && ::QueueUserAPC(winApcProc, (HANDLE)thread, (ULONG_PTR)apc) != 0;
+    if (!queued) {
+        delete apc;
+    }
+    return queued;
+}
+
+bool Thread::postMessage(int message, void* wparam, void* lparam) {
+    return !exiting && os_id != 0 && ::PostThreadMessageA((DWORD)os_id, (UINT)message, (WPARAM)wparam, (LPARAM)lparam) != 0;
+}
+
+int Thread::peekMessages(ThreadMessage m[], int max) {
+    int n = 0;
+    MSG msg;
+    while (n < max && ::PeekMessageA(&msg, 0, 0, 0, PM_REMOVE)) {
+        m[n].message = (int)msg.message;
+        m[n].wparam = (void*)msg.wParam;
+        m[n].lparam = (void*)msg.lParam;
+        n++;
+    }
+    return n;
+}
+
+bool Thread::peekMessage(ThreadMessage& m) {
+    return peekMessages(&m, 1) == 1;
+}
+
+bool Thread::hasMessages() {
+    return (HIWORD(::GetQueueStatus(QS_ALLPOSTMESSAGE)) & QS_ALLPOSTMESSAGE) != 0;
+}
+
+Thread* Thread::current() {
+    return current_thread;
+}
+
+void Thread::sample(ThreadTimes& t) {
+    FILETIME creation, exit, kernel, user;
+    HANDLE h = current_thread == this ? ::GetCurrentThread() : (HANDLE)thread;
+    if (::GetThreadTimes(h, &creation, &exit, &kernel, &user)) {
+        ULARGE_INTEGER k, u;
+        k.LowPart = kernel.dwLowDateTime;
+        k.HighPart = kernel.dwHighDateTime;
+        u.LowPart = user.dwLowDateTime;
+        u.HighPart = user.dwHighDateTime;
+        t.cpu = (long long)(k.QuadPart + u.QuadPart) * 100;
+    } else {
+        t.cpu = -1;
+    }
+    t.runnable = -1;
+    t.voluntary_switches = -1;
+    t.involuntary_switches = -1;
+}
+
 bool Thread::try_join() {
     #pragma warning(suppress: 4365)
     assert(thread != 0); // do not join twice
@@ -79,31 +214,296 @@ bool Thread::try_join() {
 
 #else
 
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <stdio.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#ifdef __MACH__
+#include <mach/mach.h>
+#endif
+
+#define null NULL
+
+struct Thread::Apc {
+    void (*f)(void*);
+    void* arg;
+    Apc* next;
+};
+
+struct Thread::Message {
+    ThreadMessage m;
+    Message* next;
+};
+
+static __thread Thread* current_thread;
+static __thread void (*block_hook)(void*, bool);
+static __thread void* block_hook_context;
+static __thread bool block_counted;
+static pthread_t main_thread = pthread_self(); // static initializers run on the main thread
+
+static bool isMainThread() {
+    return pthread_equal(pthread_self(), main_thread) != 0;
+}
+
 void* Thread::posixThreadProc(void* p) {
     Thread & t = *(Thread*)p;
+    if (t.name[0] != 0) {
+#if defined(__MACH__)
+        pthread_setname_np(t.name); // only for the calling thread
+#elif defined(__linux__)
+        pthread_setname_np(pthread_self(), t.name);
+#endif
+    }
+#ifdef __linux__
+    if (t.renice) { // Linux nice values are per thread
+        setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), t.nice_value);
+    }
+#endif
+    current_thread = &t;
+#ifdef __linux__
+    t.os_id = (int)syscall(SYS_gettid);
+#endif
+    Atomic::add(&t.started, SystemTime::realMono());
+    TRACE(TRACE_THREAD_START, &t);
     t.result = t.f(t.a);
-    t.exiting = true;
+    TRACE(TRACE_THREAD_EXIT, &t);
+    t.finish();
     return t.result;
 }
 
 Thread::Thread(void* (*func)(void*), void* arg) : f(func), a(arg), done(false), exiting(false) {
-    pthread_create(&thread, 0, Thread::posixThreadProc, this);
+    start(ThreadOptions());
+}
+
+Thread::Thread(void* (*func)(void*), void* arg, const ThreadOptions& options) :
+    f(func), a(arg), done(false), exiting(false) {
+    start(options);
+}
+
+void Thread::start(const ThreadOptions& options) {
+    strncpy(name, options.name != 0 ? options.name : "", sizeof(name) - 1);
+    name[sizeof(name) - 1] = 0;
+    os_id = 0;
+    started = 0;
+    sampled = 0;
+    blocked = 0;
+    block_begin = 0;
+    memset(&final, 0, sizeof(final));
+    apcs = 0;
+    apc = new Event(false, false);
+    inbox = 0;
+    mailbox = 0;
+    message = new Event(false, false);
+    nice_value = options.priority;
+    renice = options.policy == THREAD_SCHED_OTHER && options.priority != 0;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (options.stack != 0) {
+        pthread_attr_setstack(&attr, options.stack, options.stack_size);
+    } else {
+        if (options.stack_size != 0) {
+            size_t size = options.stack_size < (size_t)PTHREAD_STACK_MIN ? (size_t)PTHREAD_STACK_MIN : options.stack_size;
+            pthread_attr_setstacksize(&attr, size);
+        }
+        if (options.guard_size >= 0) {
+            pthread_attr_setguardsize(&attr, (size_t)options.guard_size);
+        }
+    }
+    bool realtime = options.policy == THREAD_SCHED_FIFO || options.policy == THREAD_SCHED_RR;
+    if (realtime || options.policy == THREAD_SCHED_OTHER) {
+        struct sched_param sp;
+        memset(&sp, 0, sizeof(sp));
+        sp.sched_priority = realtime ? options.priority : 0;
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, options.policy == THREAD_SCHED_FIFO ? SCHED_FIFO :
+                                            options.policy == THREAD_SCHED_RR ? SCHED_RR : SCHED_OTHER);
+        pthread_attr_setschedparam(&attr, &sp);
+    }
+    SystemTime::runnable(+1); // counted from now on: the creator may block before the thread runs
+    int r = pthread_create(&thread, &attr, Thread::posixThreadProc, this);
+    if (r == EPERM && realtime) { // not privileged for real-time scheduling
+        pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+        r = pthread_create(&thread, &attr, Thread::posixThreadProc, this);
+    }
+    assert(r == 0);
+    pthread_attr_destroy(&attr);
 }
 
 Thread::~Thread() {
     assert(thread == 0); // join() must be call before destructor
     thread = 0;
+    Apc* p = (Apc*)Atomic::exchangePointer((void* volatile*)&apcs, 0);
+    while (p != 0) { // never ran: thread exited without another alertable wait (same as Win32)
+        Apc* next = p->next;
+        delete p;
+        p = next;
+    }
+    delete apc;
+    Message* m = (Message*)Atomic::exchangePointer((void* volatile*)&inbox, 0);
+    for (int i = 0; i < 2; i++) { // never received
+        while (m != 0) {
+            Message* next = m->next;
+            delete m;
+            m = next;
+        }
+        m = mailbox;
+    }
+    delete message;
 }
 
 void* Thread::join() {
     if (!done) {
         assert(thread != 0); // do not join twice
+        blockBegin();
         pthread_join(thread, &result);
+        blockEnd();
         thread = 0;
     }
     return result;
 }
 
+bool Thread::queueApc(void (*f)(void*), void* arg) {
+    if (exiting) {
+        return false;
+    }
+    Apc* a = new Apc;
+    a->f = f;
+    a->arg = arg;
+    do {
+        a->next = apcs;
+    } while (!Atomic::compareExchangePointer((void* volatile*)&apcs, a->next, a));
+    apc->set();
+    return true;
+}
+
+int Thread::runApcs() {
+    Apc* p = (Apc*)Atomic::exchangePointer((void* volatile*)&apcs, 0);
+    Apc* fifo = 0;
+    while (p != 0) { // pushed LIFO: reverse to run in queueing order
+        Apc* next = p->next;
+        p->next = fifo;
+        fifo = p;
+        p = next;
+    }
+    int n = 0;
+    while (fifo != 0) {
+        Apc* next = fifo->next;
+        fifo->f(fifo->arg);
+        delete fifo;
+        fifo = next;
+        n++;
+    }
+    return n;
+}
+
+bool Thread::postMessage(int msg, void* wparam, void* lparam) {
+    if (exiting) {
+        return false;
+    }
+    Message* m = new Message;
+    m->m.message = msg;
+    m->m.wparam = wparam;
+    m->m.lparam = lparam;
+    do {
+        m->next = inbox;
+    } while (!Atomic::compareExchangePointer((void* volatile*)&inbox, m->next, m));
+    if (m->next == 0) { // only the first message of a batch wakes the receiver
+        message->set();
+    }
+    return true;
+}
+
+int Thread::peekMessages(ThreadMessage m[], int max) {
+    Thread* t = current_thread;
+    if (t == 0) {
+        return 0;
+    }
+    if (t->mailbox == 0 && t->inbox != 0) {
+        Message* p = (Message*)Atomic::exchangePointer((void* volatile*)&t->inbox, 0);
+        while (p != 0) { // pushed LIFO: reverse to receive in posting order
+            Message* next = p->next;
+            p->next = t->mailbox;
+            t->mailbox = p;
+            p = next;
+        }
+    }
+    int n = 0;
+    while (n < max && t->mailbox != 0) {
+        Message* next = t->mailbox->next;
+        m[n++] = t->mailbox->m;
+        delete t->mailbox;
+        t->mailbox = next;
+    }
+    return n;
+}
+
+bool Thread::peekMessage(ThreadMessage& m) {
+    return peekMessages(&m, 1) == 1;
+}
+
+bool Thread::hasMessages() {
+    Thread* t = current_thread;
+    return t != 0 && (t->mailbox != 0 || t->inbox != 0);
+}
+
+Thread* Thread::current() {
+    return current_thread;
+}
+
+#ifdef __linux__
+static FILE* openTask(int tid, const char* file) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/task/%d/%s", tid, file);
+    return fopen(path, "r");
+}
+#endif
+
+void Thread::sample(ThreadTimes& t) {
+    t.cpu = -1;
+    t.runnable = -1;
+    t.voluntary_switches = -1;
+    t.involuntary_switches = -1;
+#if defined(__MACH__)
+    thread_basic_info_data_t info;
+    mach_msg_type_number_t count = THREAD_BASIC_INFO_COUNT;
+    if (thread_info(pthread_mach_thread_np(thread), THREAD_BASIC_INFO, (thread_info_t)&info, &count) == KERN_SUCCESS) {
+        t.cpu = (info.user_time.seconds + info.system_time.seconds) * (long long)NANOSECONDS_IN_SECOND +
+                (info.user_time.microseconds + info.system_time.microseconds) * (long long)NANOSECONDS_IN_MICROSECOND;
+    }
+#else
+    clockid_t clock;
+    struct timespec ts;
+    if (current_thread == this) {
+        t.cpu = SystemTime::cpu();
+    } else if (pthread_getcpuclockid(thread, &clock) == 0 && clock_gettime(clock, &ts) == 0) {
+        t.cpu = SystemTime::fromTimespec(ts);
+    }
+#endif
+#ifdef __linux__
+    FILE* f = openTask(os_id, "schedstat"); // on-cpu, runqueue wait (ns), timeslices
+    if (f != null) {
+        long long run = 0, wait = 0;
+        if (fscanf(f, "%lld %lld", &run, &wait) == 2) {
+            t.runnable = wait;
+        }
+        fclose(f);
+    }
+    f = openTask(os_id, "status");
+    if (f != null) {
+        char line[128];
+        while (fgets(line, sizeof(line), f) != null) {
+            sscanf(line, "voluntary_ctxt_switches: %lld", &t.voluntary_switches);
+            sscanf(line, "nonvoluntary_ctxt_switches: %lld", &t.involuntary_switches);
+        }
+        fclose(f);
+    }
+#endif
+}
+
 bool Thread::try_join() {
     assert(thread != 0); // do not join twice
     // pthread_try_join is not supported yet
@@ -118,4 +518,76 @@ bool Thread::try_join() {
     return done;
 }
 
-#endif
\ No newline at end of file
+#endif
+
+/* platform independent: accounting shared by both implementations */
+
+void Thread::finish() { // on this thread right before it returns
+    final.start = Atomic::load(&started);
+    final.stop = SystemTime::realMono();
+    final.blocked = 0;
+    sample(final);
+    Atomic::store(&sampled, 1);
+    if (block_hook != 0) { // never comes back
+        block_hook(block_hook_context, true);
+        block_hook = 0;
+    }
+    SystemTime::runnable(-1);
+    exiting = true;
+}
+
+void Thread::times(ThreadTimes& t) {
+    if (Atomic::load(&sampled)) {
+        t = final;
+        t.blocked = Atomic::load(&blocked);
+        return;
+    }
+    memset(&t, 0, sizeof(t));
+    t.start = Atomic::load(&started);
+    t.blocked = Atomic::load(&blocked);
+    if (t.start == 0) {
+        return; // not running yet
+    }
+    sample(t);
+    if (Atomic::load(&sampled)) { // exited while sampled: OS may have reported nothing
+        times(t);
+    }
+}
+
+/* the virtual clock counts Thread threads from creation to exit plus the main thread, which
+   SystemTime counts from the start; other threads (raw pthreads, CreateThread) never count,
+   so their blocking is not subtracted either: they neither stop nor trigger auto advance */
+
+void Thread::blockBegin() {
+    Thread* t = current_thread;
+    if (t != 0) {
+        t->block_begin = SystemTime::realMono();
+    }
+    block_counted = SystemTime::isVirtual() && (t != 0 || isMainThread());
+    if (block_counted) {
+        SystemTime::runnable(-1);
+    }
+    if (block_hook != 0) {
+        block_hook(block_hook_context, true);
+    }
+}
+
+void Thread::blockEnd() {
+    if (block_hook != 0) {
+        block_hook(block_hook_context, false);
+    }
+    if (block_counted) { // even if the virtual clock was switched off meanwhile
+        SystemTime::runnable(+1);
+        block_counted = false;
+    }
+    Thread* t = current_thread;
+    if (t != 0 && t->block_begin != 0) {
+        Atomic::add(&t->blocked, SystemTime::realMono() - t->block_begin);
+        t->block_begin = 0;
+    }
+}
+
+void Thread::setBlockHook(void (*hook)(void*, bool), void* context) {
+    block_hook = hook;
+    block_hook_context = context;
+}
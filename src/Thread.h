@@ -35,26 +35,110 @@
 #else
 #include <pthread.h>
 #endif
+#include <stddef.h>
+
+enum { /* ThreadOptions.policy */
+    THREAD_SCHED_DEFAULT = -1, /* inherited from the creating thread */
+    THREAD_SCHED_OTHER = 0,    /* time sharing, priority is a nice value -20..19 */
+    THREAD_SCHED_FIFO = 1,     /* real-time, priority 1..99 (Win32: THREAD_PRIORITY_TIME_CRITICAL) */
+    THREAD_SCHED_RR = 2        /* real-time round robin, priority 1..99 */
+};
+
+struct ThreadOptions {
+    size_t stack_size; /* 0: default (8MB reservation on Linux), size of stack if preallocated */
+    long   guard_size; /* -1: default, 0: no guard page; ignored for preallocated stack */
+    void*  stack;      /* preallocated stack of stack_size bytes or null (POSIX only) */
+    int    policy;
+    int    priority;
+    const char* name;  /* shown by perf, top -H, gdb and debuggers (15 characters on Linux) */
+    ThreadOptions() : stack_size(0), guard_size(-1), stack(0), policy(THREAD_SCHED_DEFAULT), priority(0), name(0) { }
+};
+
+/* GetThreadTimes: all times in nanoseconds, -1 where the platform cannot tell */
+struct ThreadTimes {
+    long long start;    /* SystemTime::realMono() when the thread started running, 0 if not yet */
+    long long stop;     /* SystemTime::realMono() when the thread function returned, 0 while running */
+    long long cpu;      /* user + system CPU time */
+    long long runnable; /* ready to run but waiting for a CPU (Linux schedstat) */
+    long long blocked;  /* sleeping inside Event and CompactEvent waits and join() */
+    long long voluntary_switches;   /* context switches: blocked or yielded */
+    long long involuntary_switches; /* context switches: preempted */
+};
+
+/* PostThreadMessage: Win32 requires message >= WM_USER (0x0400) for private messages */
+struct ThreadMessage {
+    int message;
+    void* wparam;
+    void* lparam;
+};
+
+class Event;
 
 class Thread {
 public:
     Thread(void* (*f)(void*), void* arg = 0);
+    /* real-time policies fall back to inherited scheduling when not permitted (EPERM) */
+    Thread(void* (*f)(void*), void* arg, const ThreadOptions& options);
     virtual ~Thread();
     void* join(); /* ok to call after try_join for result */
     bool try_join();
+    /* QueueUserAPC: f(arg) runs on this thread inside its next alertable wait (Event::waitEx)
+       in FIFO order; may be called from any thread; returns false if the thread has exited */
+    bool queueApc(void (*f)(void*), void* arg);
+    /* PostThreadMessage: lock free, may be called from any thread; returns false if the
+       thread has exited (Win32: also before the thread created its message queue) */
+    bool postMessage(int message, void* wparam = 0, void* lparam = 0);
+    /* PeekMessage(PM_REMOVE) for the calling thread: FIFO per posting thread; the batch
+       variant returns up to max messages, the whole inbox is taken with one atomic exchange */
+    static bool peekMessage(ThreadMessage& m);
+    static int  peekMessages(ThreadMessage m[], int max);
+    static bool hasMessages(); /* no atomic read-modify-write, no syscall */
+    static Thread* current(); /* null for threads not created by Thread */
+    /* snapshot while the thread runs and final values after it returned */
+    void times(ThreadTimes& t);
+    /* called by synchronization primitives right before and after the calling thread
+       actually sleeps (not for waits satisfied at once): blocked time of Thread threads
+       and, while SystemTime virtual clock is on, its all-threads-blocked detection which
+       counts only Thread threads and the main thread */
+    static void blockBegin();
+    static void blockEnd();
+    /* per calling thread: hook(context, blocked) runs inside blockBegin() and blockEnd() and
+       with blocked == true when a Thread thread exits (CompletionPort concurrency tracking) */
+    static void setBlockHook(void (*hook)(void* context, bool blocked), void* context);
 private:
+    friend class Event;
+    struct Apc;
 #ifdef WIN32
     uintptr_t thread;
     static unsigned int __stdcall winThreadProc(void* p);
 #else
     static void* posixThreadProc(void* p);
     pthread_t thread; // do not use pthread_exit if you want to keep try_join() working...
+    int runApcs(); /* on this thread: runs queued APCs and returns how many ran */
+    Apc* volatile apcs; // lock free LIFO pushed by queueApc()
+    Event* apc;         // auto-reset, set by queueApc(): wakes alertable waits
+    struct Message;
+    Message* volatile inbox; // lock free LIFO pushed by postMessage()
+    Message* mailbox;        // FIFO taken from the inbox, owner thread only
+    Event* message;          // auto-reset, set when the inbox becomes non-empty
 #endif
+    void start(const ThreadOptions& options);
+    void sample(ThreadTimes& t); /* cpu, runnable and switches of this thread */
+    void finish();               /* on the thread: takes the final sample */
     void* (*f)(void*);
     void* a;
     void* result;
+    int  nice_value; // applied by the thread itself when policy is THREAD_SCHED_OTHER
+    bool renice;
+    char name[16];
     volatile bool  done;
     volatile bool  exiting;
+    int os_id;                   // Linux tid, Win32 thread id
+    volatile long long started;  // SystemTime::realMono()
+    volatile int sampled;        // final is valid
+    volatile long long blocked;  // total nanoseconds in blockBegin()..blockEnd()
+    long long block_begin;       // owner thread only
+    ThreadTimes final;           // sampled by the thread itself right before it exits
 };
 
 /* IMPORTANT: try_join() only works if:
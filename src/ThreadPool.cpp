@@ -0,0 +1,87 @@
+/*  Copyright (c) 2013, Leo Kuznetsov
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "ThreadPool.h"
+#include "Thread.h"
+
+#define null NULL
+
+#ifdef WIN32
+#pragma warning(disable: 4820 4514 4668 4711)
+#include <Windows.h>
+
+static int processors() {
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return (int)si.dwNumberOfProcessors;
+}
+
+#else
+#include <unistd.h>
+
+static int processors() {
+    return (int)sysconf(_SC_NPROCESSORS_ONLN);
+}
+
+#endif
+
+ThreadPool::ThreadPool(int threads, int concurrency) : port(concurrency), threads(null), count(threads) {
+    if (count <= 0) {
+        count = processors() * 2;
+        count = count < 2 ? 2 : count;
+    }
+    this->threads = new Thread*[count];
+    for (int i = 0; i < count; i++) {
+        this->threads[i] = new Thread(worker, &port);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    for (int i = 0; i < count; i++) {
+        port.post(null); // after all submitted work: FIFO
+    }
+    for (int i = 0; i < count; i++) {
+        threads[i]->join();
+        delete threads[i];
+    }
+    delete[] threads;
+}
+
+bool ThreadPool::submit(void (*f)(void*), void* arg) {
+    return port.post((void*)f, arg); // key: function (POSIX dlsym() relies on this cast too)
+}
+
+void* ThreadPool::worker(void* p) {
+    CompletionPort* port = (CompletionPort*)p;
+    Completion c;
+    while (port->get(c) && c.key != null) {
+        void (*f)(void*) = (void (*)(void*))c.key;
+        f(c.overlapped);
+    }
+    return null;
+}
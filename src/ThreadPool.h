@@ -0,0 +1,58 @@
+/*  Copyright (c) 2013, Leo Kuznetsov
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#include "CompletionPort.h"
+
+class Thread;
+
+/* Fixed set of Thread workers taking submitted work from a CompletionPort: work runs in
+   FIFO order on the most recently idle worker and a worker blocked inside the work item
+   (Event waits, join...) lets another one run in its place. */
+
+class ThreadPool {
+public:
+    /* threads <= 0: twice the number of processors (spare workers for blocked ones),
+       concurrency <= 0: number of processors */
+    ThreadPool(int threads = 0, int concurrency = 0);
+    /* runs all work submitted so far and joins the workers */
+    virtual ~ThreadPool();
+    bool submit(void (*f)(void*), void* arg = 0);
+private:
+    static void* worker(void* p);
+    CompletionPort port;
+    Thread** threads;
+    int count;
+    ThreadPool(const ThreadPool&); // not copyable
+    ThreadPool& operator=(const ThreadPool&);
+};
+
+#endif /* __THREAD_POOL_H__ */
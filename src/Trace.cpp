@@ -0,0 +1,86 @@
+/*  Copyright (c) 2013, Leo Kuznetsov
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "Trace.h"
+#include "SystemTime.h"
+#include "Atomic.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIN32
+#pragma warning(disable: 4820 4514 4668 4711 4996)
+#endif
+
+TRACE_THREAD_LOCAL Trace::Ring* Trace::ring;
+
+static void* volatile rings; // Trace::Ring*
+static volatile int threads;
+static long long mono0;
+static long long ticks0;
+
+Trace::Ring* Trace::attach() {
+    Ring* r = (Ring*)calloc(1, sizeof(Ring));
+    r->thread = Atomic::add(&threads, 1);
+    if (r->thread == 1) {
+        mono0 = SystemTime::realMono();
+        ticks0 = ticks();
+    }
+    do {
+        r->next = (Ring*)rings;
+    } while (!Atomic::compareExchangePointer(&rings, r->next, r));
+    ring = r;
+    return r;
+}
+
+bool Trace::dump(const char* filename) {
+    FILE* f = fopen(filename, "wb");
+    if (f == 0) {
+        return false;
+    }
+    Header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "W32PTRC1", sizeof(h.magic));
+    h.record_size = (int)sizeof(Record);
+    h.threads = Atomic::load(&threads);
+    h.mono0 = mono0;
+    h.ticks0 = ticks0;
+    h.mono1 = SystemTime::realMono();
+    h.ticks1 = ticks();
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    for (Ring* r = (Ring*)rings; r != 0 && ok; r = r->next) {
+        long long head = r->head;
+        long long n = head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE;
+        for (long long i = head - n; i < head && ok; i++) { // oldest first
+            ok = fwrite(&r->records[i & (TRACE_RING_SIZE - 1)], sizeof(Record), 1, f) == 1;
+        }
+        h.records += n;
+    }
+    ok = ok && fseek(f, 0, SEEK_SET) == 0 && fwrite(&h, sizeof(h), 1, f) == 1; // with final records count
+    return fclose(f) == 0 && ok;
+}
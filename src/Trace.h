@@ -0,0 +1,139 @@
+/*  Copyright (c) 2013, Leo Kuznetsov
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+/* Compile time optional binary tracing of Event and Thread activity.
+   Build with -DEVENT_TRACE to enable; otherwise TRACE() compiles to nothing.
+   Each thread appends fixed size records to its own ring buffer (single writer, no locks,
+   no atomics): the newest TRACE_RING_SIZE records per thread survive.
+   Trace::dump() writes all rings to a file; tools/trace2json.cpp converts it
+   to Chrome/Perfetto trace JSON (chrome://tracing, ui.perfetto.dev) and tools/wakechain.cpp
+   reports the critical path and waker -> wakee blocked time from TRACE_WOKEN_BY records.
+   Dumping while other threads are still tracing may catch their newest records half written. */
+
+#ifdef EVENT_TRACE
+#define TRACE(op, object) Trace::record(op, object)
+#define TRACE_WOKEN_BY(setter, ticks) Trace::wokenBy(setter, ticks)
+#else
+#define TRACE(op, object) ((void)0)
+#define TRACE_WOKEN_BY(setter, ticks) ((void)0)
+#endif
+
+#ifndef TRACE_RING_SIZE
+#define TRACE_RING_SIZE 8192 /* records per thread, must be power of 2 */
+#endif
+
+#ifdef WIN32
+#define TRACE_THREAD_LOCAL __declspec(thread)
+#else
+#define TRACE_THREAD_LOCAL __thread
+#endif
+
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#ifdef WIN32
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define TRACE_TSC
+#else
+#include "SystemTime.h"
+#endif
+
+enum { /* Trace::Record.op */
+    TRACE_SET = 1,
+    TRACE_RESET,
+    TRACE_WAIT_BEGIN,   /* thread is about to block on object */
+    TRACE_WAKE,         /* thread woken by object */
+    TRACE_TIMEOUT,      /* wait on object timed out */
+    TRACE_THREAD_START, /* object: Thread* */
+    TRACE_THREAD_EXIT,
+    TRACE_WOKEN_BY      /* follows TRACE_WAKE: time of the set() that woke the thread, object: setter trace thread id */
+};
+
+class Trace {
+public:
+    struct Record {
+        long long time; // ticks(), converted to nanoseconds by the dump reader
+        unsigned long long object;
+        int thread;     // small sequential trace thread id
+        int op;
+    };
+    struct Header { // file layout: Header followed by "records" Records
+        char magic[8]; // "W32PTRC1"
+        int record_size;
+        int threads;
+        long long records;
+        long long mono0, ticks0; // SystemTime::realMono() and ticks() at first record
+        long long mono1, ticks1; // and at dump time
+    };
+    static inline void record(int op, const void* object) {
+        Ring* r = ring != 0 ? ring : attach();
+        Record &rec = r->records[r->head & (TRACE_RING_SIZE - 1)];
+        rec.time = ticks();
+        rec.object = (unsigned long long)(size_t)object;
+        rec.thread = r->thread;
+        rec.op = op;
+        r->head++;
+    }
+    static inline void wokenBy(int setter, long long set_ticks) {
+        Ring* r = ring != 0 ? ring : attach();
+        Record &rec = r->records[r->head & (TRACE_RING_SIZE - 1)];
+        rec.time = set_ticks;
+        rec.object = (unsigned long long)setter;
+        rec.thread = r->thread;
+        rec.op = TRACE_WOKEN_BY;
+        r->head++;
+    }
+    static inline int thread() { /* trace thread id of the calling thread */
+        return (ring != 0 ? ring : attach())->thread;
+    }
+    static inline long long ticks() {
+#ifdef TRACE_TSC
+        return (long long)__rdtsc();
+#else
+        return SystemTime::realMono(); // not virtual: calibrated against mono0/mono1
+#endif
+    }
+    static bool dump(const char* filename);
+private:
+    struct Ring {
+        Record records[TRACE_RING_SIZE];
+        volatile long long head; // number of records ever written
+        int thread;
+        Ring* next; // all rings, never freed so records of exited threads can be dumped
+    };
+    static Ring* attach();
+    static TRACE_THREAD_LOCAL Ring* ring;
+    Trace() { /* do not instantiate */ }
+};
+
+#endif /* __TRACE_H__ */
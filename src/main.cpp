@@ -32,6 +32,28 @@
 #include "SystemTime.h"
 #include "Event.h"
 #include "Thread.h"
+#include "SRWLock.h"
+#include "ConditionVariable.h"
+#include "Barrier.h"
+#include "CountdownLatch.h"
+#include "Atomic.h"
+#include "Trace.h"
+#include "Fiber.h"
+#include "FiberScheduler.h"
+#include "ParkingLot.h"
+#include "CompactEvent.h"
+#include "CompletionPort.h"
+#include "ThreadPool.h"
+#include "Future.h"
+#include "EventCount.h"
+#include "MPMCQueue.h"
+#ifndef WIN32
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#endif
 
 #define null NULL
 #define countof(a) (sizeof(a) / sizeof((a)[0]))
@@ -156,9 +178,1020 @@ static void* wait_multiple(void*) {
     return (void*)"wait_multiple";
 }
 
+static void* test_named_wait(void*) {
+    Event ping("win32posix.test.ping");
+    Event pong("win32posix.test.pong");
+    int r = Event::waitAny(NANOSECONDS_IN_SECOND, ping, pong);
+    assert(r == 0);
+    pong.set();
+    return (void*)"test_named_wait";
+}
+
+static void testNamed() {
+    {
+        Event ping("win32posix.test.ping", false, false);
+        Event pong("win32posix.test.pong", false, false);
+        assert(ping.isValid() && pong.isValid());
+        {   // same name opened twice in the same process is the same event
+            Thread t(test_named_wait);
+            SystemTime::sleep(NANOSECONDS_IN_SECOND / 32);
+            ping.set();
+            int r = pong.wait(NANOSECONDS_IN_SECOND);
+            assert(r == 0);
+            t.join();
+        }
+#ifndef WIN32
+        pid_t pid = fork();
+        if (pid == 0) { // child process
+            test_named_wait(null);
+            _exit(0);
+        }
+        SystemTime::sleep(NANOSECONDS_IN_SECOND / 32);
+        ping.set();
+        int r = pong.wait(NANOSECONDS_IN_SECOND);
+        assert(r == 0);
+        int status = -1;
+        waitpid(pid, &status, 0);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+        pid = fork();
+        if (pid == 0) { // crashes holding a reference: never closed
+            Event crash("win32posix.test.crash", true, true);
+            _exit(crash.isValid() ? 0 : 1);
+        }
+        waitpid(pid, &status, 0);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+        Event crash("win32posix.test.crash", false, false); // reclaimed: created anew, not signaled
+        r = crash.wait(0);
+        assert(r == EVENT_WAIT_TIMEOUT);
+#endif
+        int consumed = pong.wait(0);
+        assert(consumed == EVENT_WAIT_TIMEOUT); // auto reset events consumed
+        char name[128];
+        memset(name, 'x', sizeof(name) - 1);
+        name[sizeof(name) - 1] = 0;
+        Event invalid(name); // too long for POSIX (64 characters), fine for Win32
+        if (!invalid.isValid()) {
+            int failed = invalid.wait(0);
+            assert(failed == EVENT_WAIT_FAILED);
+        }
+    }
+#ifndef WIN32
+    int fd = shm_open("/win32posix.events", O_RDONLY, 0); // unlinked by the last close
+    assert(fd < 0 && errno == ENOENT);
+#endif
+}
+
+static Event realtime_event(false, false, EVENT_REALTIME);
+static int realtime_order[5];
+static int realtime_priority[5]; // SCHED_FIFO priority the waiter actually got, 0 if none
+static volatile int realtime_woken;
+
+static void* test_realtime_wait(void* p) {
+#ifndef WIN32
+    int policy = SCHED_OTHER;
+    struct sched_param sp;
+    memset(&sp, 0, sizeof(sp));
+    pthread_getschedparam(pthread_self(), &policy, &sp);
+    realtime_priority[(int)(long)p] = policy == SCHED_FIFO ? sp.sched_priority : 0;
+#endif
+    int r = realtime_event.wait();
+    assert(r == 0);
+    realtime_order[realtime_woken++] = (int)(long)p;
+    return null;
+}
+
+static void testRealtime() {
+    // same priority waiters are woken in FIFO order
+    Thread t0(test_realtime_wait, (void*)0);
+    SystemTime::sleep(NANOSECONDS_IN_SECOND / 32);
+    Thread t1(test_realtime_wait, (void*)1);
+    SystemTime::sleep(NANOSECONDS_IN_SECOND / 32);
+    Thread t2(test_realtime_wait, (void*)2);
+    SystemTime::sleep(NANOSECONDS_IN_SECOND / 32);
+    for (int i = 0; i < 3; i++) {
+        realtime_event.set();
+        SystemTime::sleep(NANOSECONDS_IN_SECOND / 32);
+    }
+    t0.join();
+    t1.join();
+    t2.join();
+    assert(realtime_woken == 3);
+    for (int i = 0; i < 3; i++) {
+        assert(realtime_order[i] == i);
+    }
+#ifndef WIN32
+    assert(realtime_event.worstWakeLatency() > 0);
+#endif
+    // a higher priority waiter is released first even though it came later
+    ThreadOptions low;
+    low.policy = THREAD_SCHED_FIFO;
+    low.priority = 10;
+    ThreadOptions high = low;
+    high.priority = 20;
+    Thread t3(test_realtime_wait, (void*)3, low);
+    SystemTime::sleep(NANOSECONDS_IN_SECOND / 32);
+    Thread t4(test_realtime_wait, (void*)4, high);
+    SystemTime::sleep(NANOSECONDS_IN_SECOND / 32);
+    for (int i = 0; i < 2; i++) {
+        realtime_event.set();
+        SystemTime::sleep(NANOSECONDS_IN_SECOND / 32);
+    }
+    t3.join();
+    t4.join();
+    assert(realtime_woken == 5);
+    if (realtime_priority[4] > realtime_priority[3]) { // not privileged: both fell back to SCHED_OTHER
+        assert(realtime_order[3] == 4 && realtime_order[4] == 3);
+    }
+}
+
+struct TestSRW {
+    SRWLock lock;
+    ConditionVariable cv;
+    int counter;
+    int copy; // always equal to counter when observed under the lock
+};
+
+static void* test_srw_writer(void* p) {
+    TestSRW &t = *(TestSRW*)p;
+    for (int i = 0; i < 10000; i++) {
+        t.lock.acquireExclusive();
+        t.counter++;
+        t.copy = t.counter;
+        t.lock.releaseExclusive();
+        t.cv.wakeAll();
+    }
+    return null;
+}
+
+static void* test_srw_reader(void* p) {
+    TestSRW &t = *(TestSRW*)p;
+    t.lock.acquireShared();
+    while (t.counter < 20000) {
+        assert(t.copy == t.counter);
+        t.cv.sleep(t.lock, NANOSECONDS_IN_MILLISECOND, true);
+    }
+    t.lock.releaseShared();
+    return null;
+}
+
+static void testSRWLock() {
+    TestSRW test;
+    test.counter = 0;
+    test.copy = 0;
+    Thread r0(test_srw_reader, &test);
+    Thread r1(test_srw_reader, &test);
+    Thread w0(test_srw_writer, &test);
+    Thread w1(test_srw_writer, &test);
+    w0.join();
+    w1.join();
+    r0.join();
+    r1.join();
+    assert(test.counter == 20000);
+    bool acquired = test.lock.tryAcquireShared();
+    assert(acquired);
+    acquired = test.lock.tryAcquireShared();
+    assert(acquired);
+    acquired = test.lock.tryAcquireExclusive();
+    assert(!acquired);
+    test.lock.releaseShared();
+    test.lock.releaseShared();
+    acquired = test.lock.tryAcquireExclusive();
+    assert(acquired);
+    acquired = test.lock.tryAcquireShared();
+    assert(!acquired);
+    bool woken = test.cv.sleep(test.lock, NANOSECONDS_IN_SECOND / 32);
+    assert(!woken); // nobody wakes it: times out and reacquires
+    acquired = test.lock.tryAcquireShared();
+    assert(!acquired);
+    test.lock.releaseExclusive();
+}
+
+struct TestBarrier {
+    Barrier* barrier;
+    DisseminationBarrier* dissemination;
+    CountdownLatch* latch;
+    volatile int arrived[8]; // phases completed by each thread
+    int threads;
+    int phases;
+    volatile int next_id;
+    volatile int last; // number of enter() calls returned true
+};
+
+static void* test_barrier(void* p) {
+    TestBarrier &t = *(TestBarrier*)p;
+    int id = Atomic::add(&t.next_id, 1) - 1;
+    for (int i = 0; i < t.phases; i++) {
+        t.arrived[id] = i + 1;
+        bool last = t.barrier != null ? t.barrier->enter() : t.dissemination->enter(id);
+        if (last) {
+            Atomic::add(&t.last, 1);
+        }
+        for (int j = 0; j < t.threads; j++) {
+            assert(t.arrived[j] >= i + 1); // nobody passed before everybody arrived
+        }
+        if (t.barrier != null) {
+            t.barrier->enter(); // second barrier: nobody starts next phase while others check
+        } else {
+            t.dissemination->enter(id);
+        }
+    }
+    t.latch->countDown();
+    return null;
+}
+
+static void testBarrier() {
+    for (int k = 0; k < 3; k++) {
+        TestBarrier test;
+        memset(&test, 0, sizeof(test));
+        test.threads = countof(test.arrived);
+        test.phases = 100;
+        Barrier barrier(test.threads, k == 1 ? 100 : 0);
+        DisseminationBarrier dissemination(test.threads);
+        CountdownLatch latch(test.threads);
+        test.barrier = k < 2 ? &barrier : null;
+        test.dissemination = k < 2 ? null : &dissemination;
+        test.latch = &latch;
+        Thread* t[countof(test.arrived)];
+        for (int i = 0; i < test.threads; i++) { t[i] = new Thread(test_barrier, &test); }
+        bool done = latch.wait(NANOSECONDS_IN_SECOND * 10LL);
+        assert(done && latch.count() == 0);
+        for (int i = 0; i < test.threads; i++) { t[i]->join(); delete t[i]; }
+        assert(test.last == test.phases);
+    }
+    CountdownLatch never(1);
+    int r = never.wait(NANOSECONDS_IN_SECOND / 32);
+    assert(!r);
+}
+
+struct TestOrder {
+    Event* a;
+    Event* b;
+    bool reverse;
+};
+
+static void* test_order_wait(void* p) {
+    TestOrder &t = *(TestOrder*)p;
+    for (int i = 0; i < 100000; i++) {
+        int r = t.reverse ? Event::waitAll(*t.b, *t.a) : Event::waitAll(*t.a, *t.b);
+        assert(r == 0);
+    }
+    return null;
+}
+
+static void testWaitAll() {
+    Event a(true, true);
+    Event b(true, true);
+    TestOrder ab = {&a, &b, false};
+    TestOrder ba = {&a, &b, true};
+    Thread t0(test_order_wait, &ab); // waitAll(a, b) and waitAll(b, a) concurrently must not deadlock
+    Thread t1(test_order_wait, &ba);
+    t0.join();
+    t1.join();
+    Event x(false, true);
+    Event y(false, false);
+    // waitAll consumes nothing unless all events are signaled
+    int r = Event::waitAll(NANOSECONDS_IN_SECOND / 32, x, y);
+    assert(r == EVENT_WAIT_TIMEOUT);
+    r = x.wait(0);
+    assert(r == 0);
+    r = x.wait(0);
+    assert(r == EVENT_WAIT_TIMEOUT); // satisfied waits consume auto-reset events
+    x.set();
+    y.set();
+    r = Event::waitAll(0, x, y);
+    assert(r == 0);
+    r = Event::waitAny(0, x, y);
+    assert(r == EVENT_WAIT_TIMEOUT);
+    x.set();
+    y.set();
+    r = Event::waitAny(0, x, y);
+    assert(r == 0); // waitAny consumes only the first one
+    r = Event::waitAny(0, x, y);
+    assert(r == 1);
+}
+
+static char test_stack[256 * 1024];
+
+static void* test_options(void* p) {
+    char local = 0;
+    const ThreadOptions &o = *(const ThreadOptions*)p;
+    if (o.stack != null) {
+        assert((char*)o.stack <= &local && &local < (char*)o.stack + o.stack_size);
+    }
+#if defined(__linux__)
+    char name[16] = {0};
+    pthread_getname_np(pthread_self(), name, sizeof(name));
+    assert(strcmp(name, o.name) == 0);
+#endif
+    return (void*)"test_options";
+}
+
+static void testThreadOptions() {
+    ThreadOptions o;
+    o.name = "small-stack";
+    o.stack_size = 64 * 1024;
+    o.guard_size = 4096;
+    Thread t0(test_options, &o, o);
+    t0.join();
+    ThreadOptions fifo;
+    fifo.name = "realtime";
+    fifo.policy = THREAD_SCHED_FIFO;
+    fifo.priority = 10;
+    Thread t1(test_options, &fifo, fifo);
+    t1.join();
+#ifndef WIN32
+    ThreadOptions preallocated;
+    preallocated.name = "preallocated";
+    preallocated.stack = test_stack;
+    preallocated.stack_size = sizeof(test_stack);
+    Thread t2(test_options, &preallocated, preallocated);
+    const char* r = (const char*)t2.join();
+    assert(strcmp(r, "test_options") == 0);
+#endif
+}
+
+struct TestFiber {
+    Fiber* other;
+    int count;
+};
+
+static void test_ping_pong(void* p) {
+    TestFiber &t = *(TestFiber*)p;
+    t.count++;
+    t.other->switchTo(); // nested: "other" returns here when it finishes
+    assert(Fiber::current() != t.other && t.other->finished());
+    t.count++;
+}
+
+static void test_pong(void* p) {
+    ((TestFiber*)p)->count++;
+}
+
+struct TestFiberWait {
+    Event* go;
+    Event* done;
+    int volatile woken;
+    int fibers;
+};
+
+static void test_fiber_wait(void* p) {
+    TestFiberWait &t = *(TestFiberWait*)p;
+    int r = t.go->wait(); // parks the fiber, not the thread
+    assert(r == 0);
+    if (Atomic::add(&t.woken, 1) == t.fibers) {
+        t.done->set();
+    }
+}
+
+static void test_fiber_timeout(void* p) {
+    Event never;
+    long long time = SystemTime::mono();
+    int r = never.wait(NANOSECONDS_IN_SECOND / 32);
+    assert(r == EVENT_WAIT_TIMEOUT);
+    assert(SystemTime::mono() - time >= NANOSECONDS_IN_SECOND / 32);
+    *(int*)p = 1;
+}
+
+static void test_fiber_yield(void* p) {
+    for (int i = 0; i < 100; i++) {
+        (*(int*)p)++;
+        FiberScheduler::yield();
+    }
+}
+
+static void test_fiber_set(void* p) {
+    FiberScheduler::yield(); // let waiters park first
+    ((TestFiberWait*)p)->go->set();
+}
+
+static void* test_scheduler(void* p) {
+    FiberScheduler scheduler;
+    TestFiberWait &t = *(TestFiberWait*)p;
+    for (int i = 0; i < t.fibers; i++) { scheduler.spawn(test_fiber_wait, &t); }
+    int timedout = 0;
+    int yields = 0;
+    scheduler.spawn(test_fiber_timeout, &timedout);
+    scheduler.spawn(test_fiber_yield, &yields);
+    scheduler.run();
+    assert(timedout == 1 && yields == 100);
+    return null;
+}
+
+static void testFiber() {
+    TestFiber t = {null, 0};
+    Fiber pong(test_pong, &t);
+    Fiber ping(test_ping_pong, &t);
+    t.other = &pong;
+    ping.switchTo();
+    assert(ping.finished() && pong.finished() && t.count == 3);
+    assert(Fiber::current() == null);
+    // manual-reset event set by another thread wakes all parked fibers
+    Event go(true, false);
+    Event done(false, false);
+    TestFiberWait w = {&go, &done, 0, 1000};
+    Thread scheduler(test_scheduler, &w);
+    SystemTime::sleep(NANOSECONDS_IN_SECOND / 32);
+    go.set();
+    int r = done.wait(NANOSECONDS_IN_SECOND * 10LL);
+    assert(r == 0);
+    scheduler.join();
+    // auto-reset event set by a fiber on the same scheduler
+    Event next(false, false);
+    TestFiberWait one = {&next, &done, 0, 1};
+    FiberScheduler s;
+    s.spawn(test_fiber_wait, &one);
+    s.spawn(test_fiber_set, &one);
+    s.run();
+    r = done.wait(0);
+    assert(one.woken == 1 && r == 0);
+}
+
+struct TestApc {
+    Event* ready;
+    Event* never;
+    Event* quit;
+    int volatile order[3];
+    int volatile ran;
+};
+
+static void test_apc(void* p) {
+    TestApc &t = *(TestApc*)p;
+    assert(Thread::current() != null);
+    t.order[t.ran] = t.ran;
+    t.ran++;
+}
+
+static void* test_apc_thread(void* p) {
+    TestApc &t = *(TestApc*)p;
+    t.ready->set();
+    while (t.ran < 3) { // APCs queued together may be run by one or several waits
+        int r = t.never->waitEx(NANOSECONDS_IN_SECOND * 10LL, true);
+        assert(r == EVENT_WAIT_IO_COMPLETION);
+    }
+    assert(t.order[0] == 0 && t.order[1] == 1 && t.order[2] == 2);
+    t.ready->set();
+    t.quit->wait(); // APC queued now waits for the next alertable wait
+    assert(t.ran == 3);
+    int r = t.never->waitEx(0, true);
+    assert(r == EVENT_WAIT_IO_COMPLETION && t.ran == 4);
+    Event* e[2] = {t.never, t.quit};
+    t.ready->set();
+    r = Event::waitEx(NANOSECONDS_IN_SECOND * 10LL, true, true, 2, e); // waitAll is alertable too
+    assert(r == EVENT_WAIT_IO_COMPLETION && t.ran == 5);
+    r = t.quit->waitEx(NANOSECONDS_IN_SECOND * 10LL, true);
+    assert(r == 0);
+    return null;
+}
+
+static void testApc() {
+    Event ready;
+    Event never;
+    Event quit;
+    TestApc t = {&ready, &never, &quit, {-1, -1, -1}, 0};
+    Thread thread(test_apc_thread, &t);
+    ready.wait();
+    SystemTime::sleep(NANOSECONDS_IN_SECOND / 64);
+    for (int i = 0; i < 3; i++) {
+        bool queued = thread.queueApc(test_apc, &t);
+        assert(queued);
+    }
+    ready.wait();
+    bool queued = thread.queueApc(test_apc, &t);
+    assert(queued);
+    SystemTime::sleep(NANOSECONDS_IN_SECOND / 64);
+    quit.set();
+    ready.wait();
+    SystemTime::sleep(NANOSECONDS_IN_SECOND / 64);
+    queued = thread.queueApc(test_apc, &t);
+    assert(queued);
+    quit.set();
+    thread.join();
+    assert(t.ran == 5 && Thread::current() == null);
+}
+
+struct TestCompact {
+    CompactEvent* events;
+    CompactEvent* go;
+    int n;
+    int volatile woken;
+};
+
+static void* test_compact_wait(void* p) {
+    TestCompact &t = *(TestCompact*)p;
+    int r = t.go->wait(NANOSECONDS_IN_SECOND * 10LL);
+    assert(r == 0);
+    for (int i = 0; i < t.n; i++) {
+        r = t.events[i].wait(NANOSECONDS_IN_SECOND * 10LL);
+        assert(r == 0);
+        Atomic::add(&t.woken, 1);
+    }
+    return null;
+}
+
+static void* test_compact_pulse(void* p) {
+    TestCompact &t = *(TestCompact*)p;
+    int r = t.go->wait(NANOSECONDS_IN_SECOND * 10LL);
+    assert(r == 0);
+    Atomic::add(&t.woken, 1);
+    return null;
+}
+
+static void* test_compact_set_reset(void* p) {
+    CompactEvent* e = (CompactEvent*)p;
+    e->set();
+    e->reset(); // SCHED_FIFO: before the parked waiters get to run (if privileged)
+    return null;
+}
+
+static void testCompactEvent() {
+    assert(sizeof(CompactEvent) == 1);
+    enum { N = 4, M = 1000 };
+    CompactEvent* events = new CompactEvent[M]; // auto-reset: each set() releases one waiter
+    CompactEvent go(true, false);
+    TestCompact t = {events, &go, M, 0};
+    Thread* threads[N];
+    for (int i = 0; i < N; i++) { threads[i] = new Thread(test_compact_wait, &t); }
+    SystemTime::sleep(NANOSECONDS_IN_SECOND / 64);
+    go.set(); // manual-reset: wakes all
+    for (int i = 0; i < M; i++) {
+        for (int k = 0; k < N; k++) {
+            events[i].set();
+            while (Atomic::load(&t.woken) < i * N + k + 1) { SystemTime::sleep(0); }
+            assert(t.woken == i * N + k + 1);
+        }
+    }
+    for (int i = 0; i < N; i++) { threads[i]->join(); delete threads[i]; }
+    assert(t.woken == N * M);
+    delete[] events;
+    CompactEvent pulse(true, false);
+    TestCompact p = {null, &pulse, 0, 0};
+    for (int i = 0; i < N; i++) { threads[i] = new Thread(test_compact_pulse, &p); }
+    SystemTime::sleep(NANOSECONDS_IN_SECOND / 64);
+    ThreadOptions fifo;
+    fifo.policy = THREAD_SCHED_FIFO;
+    fifo.priority = 10;
+    Thread pulser(test_compact_set_reset, &pulse, fifo);
+    pulser.join();
+    for (int i = 0; i < N; i++) { threads[i]->join(); delete threads[i]; } // released anyway
+    assert(p.woken == N);
+    CompactEvent never;
+    int r = never.wait(NANOSECONDS_IN_SECOND / 64);
+    assert(r == EVENT_WAIT_TIMEOUT);
+    never.set();
+    r = never.wait(0);
+    assert(r == 0);
+    r = never.wait(0); // auto-reset: consumed by the first one
+    assert(r == EVENT_WAIT_TIMEOUT);
+    int word = 1;
+    int one = 1;
+    bool woken = ParkingLot::waitOnAddress(&word, &one, sizeof(word), NANOSECONDS_IN_SECOND / 64);
+    assert(!woken);
+    int two = 2;
+    woken = ParkingLot::waitOnAddress(&word, &two, sizeof(word), 0); // value differs: returns at once
+    assert(woken);
+    int unparked = ParkingLot::unparkAll(&word);
+    assert(unparked == 0);
+}
+
+struct TestBroadcast {
+    Event* event;
+    long long timeout;
+    int volatile woken;
+};
+
+static void* test_broadcast_wait(void* p) {
+    TestBroadcast &t = *(TestBroadcast*)p;
+    int r = t.event->wait(t.timeout);
+    assert(r == EVENT_WAIT_OBJECT_0);
+    Atomic::add(&t.woken, 1);
+    return null;
+}
+
+static void* test_broadcast_late(void* p) {
+    int r = ((Event*)p)->wait(NANOSECONDS_IN_SECOND / 32);
+    assert(r == EVENT_WAIT_TIMEOUT);
+    return null;
+}
+
+static void testBroadcast() {
+    enum { N = 64 };
+    Event e(true, false);
+    int r = e.wait(NANOSECONDS_IN_MILLISECOND);
+    assert(r == EVENT_WAIT_TIMEOUT);
+    for (int k = 0; k < 2; k++) {
+        TestBroadcast t = {&e, k == 0 ? (long long)EVENT_INFINITE : NANOSECONDS_IN_SECOND * 10LL, 0};
+        Thread* threads[N];
+        for (int i = 0; i < N; i++) { threads[i] = new Thread(test_broadcast_wait, &t); }
+        SystemTime::sleep(NANOSECONDS_IN_SECOND / 64);
+        e.set();
+        Thread* late[4] = {};
+        if (k == 1) {
+            e.reset(); // PulseEvent: everybody already waiting is released anyway
+            // late waiters sleep on the same futex while the released ones wake each other
+            for (int i = 0; i < (int)countof(late); i++) { late[i] = new Thread(test_broadcast_late, &e); }
+            r = e.wait(NANOSECONDS_IN_MILLISECOND); // but not a waiter that comes later
+            assert(r == EVENT_WAIT_TIMEOUT);
+        }
+        for (int i = 0; i < N; i++) { threads[i]->join(); delete threads[i]; }
+        for (int i = 0; i < (int)countof(late); i++) {
+            if (late[i] != null) { late[i]->join(); delete late[i]; }
+        }
+        assert(t.woken == N);
+        r = e.wait(0);
+        assert(r == (k == 0 ? EVENT_WAIT_OBJECT_0 : EVENT_WAIT_TIMEOUT));
+        e.reset();
+    }
+}
+
+static void* test_times(void* p) {
+    Event* e = (Event*)p;
+    long long cpu = SystemTime::cpu();
+    while (SystemTime::cpu() - cpu < NANOSECONDS_IN_SECOND / 20) { } // CPU bound for 50ms
+    e[0].set();
+    int r = e[1].wait(); // then starved on an event
+    assert(r == 0);
+    return null;
+}
+
+static void testThreadTimes() {
+    Event e[2];
+    Thread thread(test_times, e);
+    e[0].wait();
+    ThreadTimes running;
+    thread.times(running);
+    assert(running.start > 0 && running.stop == 0);
+    assert(running.cpu == -1 || running.cpu >= NANOSECONDS_IN_SECOND / 20);
+    SystemTime::sleep(NANOSECONDS_IN_SECOND / 20);
+    e[1].set();
+    thread.join();
+    ThreadTimes t;
+    thread.times(t);
+    assert(t.start == running.start && t.stop > t.start);
+    assert(t.cpu == -1 || (t.cpu >= running.cpu && t.cpu < t.stop - t.start));
+    assert(t.blocked >= NANOSECONDS_IN_SECOND / 40 && t.blocked < t.stop - t.start);
+#ifdef __linux__
+    assert(t.voluntary_switches >= 1 && t.involuntary_switches >= 0 && t.runnable >= 0);
+#endif
+}
+
+struct TestVirtual {
+    Event* e;
+    long long deadline; // absolute: the thread may start before or after advance()
+};
+
+static void* test_virtual_wait(void* p) {
+    TestVirtual &t = *(TestVirtual*)p;
+    int r = t.e->wait(t.deadline - SystemTime::mono());
+    assert(r == EVENT_WAIT_TIMEOUT);
+    assert(SystemTime::mono() >= t.deadline);
+    return null;
+}
+
+static void testVirtualClock() {
+    long long real = SystemTime::mono();
+    SystemTime::virtualClock(true, false); // manual: only advance() moves time
+    long long time = SystemTime::mono();
+    long long wall = SystemTime::wall();
+    Event e;
+    TestVirtual v = {&e, time + NANOSECONDS_IN_SECOND * 3600LL};
+    Thread t(test_virtual_wait, &v);
+    SystemTime::advance(NANOSECONDS_IN_SECOND * 1800LL);
+    bool joined = t.try_join();
+    assert(!joined); // half an hour later still waiting
+    SystemTime::advance(NANOSECONDS_IN_SECOND * 1800LL);
+    t.join();
+    assert(SystemTime::mono() - time == NANOSECONDS_IN_SECOND * 3600LL);
+    assert(SystemTime::wall() - wall == NANOSECONDS_IN_SECOND * 3600LL);
+    SystemTime::virtualClock(false);
+    SystemTime::virtualClock(true); // auto advance: sleeping an hour takes no time
+    time = SystemTime::mono();
+    SystemTime::sleep(NANOSECONDS_IN_SECOND * 3600LL);
+    assert(SystemTime::mono() - time >= NANOSECONDS_IN_SECOND * 3600LL);
+    v.deadline = SystemTime::mono() + NANOSECONDS_IN_SECOND * 3600LL;
+    Thread t2(test_virtual_wait, &v);
+    t2.join(); // joining blocks this thread too: the clock jumps to the waiter's deadline
+    CompactEvent never; // ParkingLot timeouts follow the virtual clock as well
+    time = SystemTime::mono();
+    int r = never.wait(NANOSECONDS_IN_SECOND * 3600LL);
+    assert(r == EVENT_WAIT_TIMEOUT);
+    assert(SystemTime::mono() - time >= NANOSECONDS_IN_SECOND * 3600LL);
+    FiberScheduler s; // and so do timed waits of parked fibers
+    int timedout = 0;
+    s.spawn(test_fiber_timeout, &timedout);
+    s.run();
+    assert(timedout == 1);
+    CountdownLatch latch(1); // real time: returns after a millisecond, the clock stays
+    time = SystemTime::mono();
+    bool counted = latch.wait(NANOSECONDS_IN_MILLISECOND);
+    assert(!counted && SystemTime::mono() == time);
+    SystemTime::virtualClock(false);
+    assert(SystemTime::mono() - real < NANOSECONDS_IN_SECOND * 10LL);
+}
+
+enum { TEST_MESSAGE = 0x0400 }; // WM_USER
+
+struct TestActor {
+    Thread* actor;
+    Event* quit;
+    Event* started;
+    int messages; // per producer
+    long long sum;
+    int received;
+    int volatile posted;
+};
+
+static void* test_actor(void* p) {
+    TestActor &t = *(TestActor*)p;
+    ThreadMessage m[64];
+    int r = Event::waitAnyOrMessage(0, *t.quit);
+    assert(r == EVENT_WAIT_TIMEOUT);
+    t.started->set();
+    int last[2] = {-1, -1};
+    for (;;) {
+        r = Event::waitAnyOrMessage(EVENT_INFINITE, *t.quit);
+        int k = Thread::peekMessages(m, countof(m));
+        assert(r == 0 || k > 0);
+        for (int i = 0; i < k; i++) {
+            assert(m[i].message == TEST_MESSAGE);
+            int producer = (int)(long long)m[i].wparam;
+            int value = (int)(long long)m[i].lparam;
+            assert(value == last[producer] + 1); // FIFO per posting thread
+            last[producer] = value;
+            t.sum += value;
+            t.received++;
+        }
+        if (r == 0 && !Thread::hasMessages()) {
+            break;
+        }
+    }
+    return null;
+}
+
+static void* test_producer(void* p) {
+    TestActor &t = *(TestActor*)p;
+    int producer = Atomic::add(&t.posted, 1) - 1;
+    for (int i = 0; i < t.messages; i++) {
+        bool posted = t.actor->postMessage(TEST_MESSAGE, (void*)(long long)producer, (void*)(long long)i);
+        assert(posted);
+    }
+    return null;
+}
+
+static void testMessages() {
+    Event quit(true, false);
+    Event started;
+    TestActor t = {null, &quit, &started, 10000, 0, 0, 0};
+    Thread actor(test_actor, &t);
+    t.actor = &actor;
+    started.wait();
+    Thread p0(test_producer, &t);
+    Thread p1(test_producer, &t);
+    p0.join();
+    p1.join();
+    quit.set();
+    actor.join();
+    assert(t.received == 2 * t.messages);
+    assert(t.sum == 2LL * t.messages * (t.messages - 1) / 2);
+    bool posted = actor.postMessage(TEST_MESSAGE);
+    assert(!posted);
+    ThreadMessage m;
+    bool peeked = Thread::peekMessage(m);
+    assert(!peeked && !Thread::hasMessages()); // main thread has no inbox
+}
+
+enum { TEST_WORK = 1, TEST_BLOCK = 2, TEST_UNBLOCK = 3, TEST_WHO = 4 }; // completion keys, null: quit
+
+struct TestPort {
+    CompletionPort* port;
+    Event* unblock;
+    int volatile working;
+    int volatile max_working;
+    int volatile completed;
+    int volatile who;
+};
+
+struct TestWorker {
+    TestPort* t;
+    int id;
+};
+
+static void* test_port_worker(void* p) {
+    TestWorker &w = *(TestWorker*)p;
+    TestPort &t = *w.t;
+    Completion c;
+    while (t.port->get(c) && c.key != null) {
+        if (c.key == (void*)TEST_WORK) {
+            int n = Atomic::add(&t.working, 1);
+            for (;;) {
+                int m = Atomic::load(&t.max_working);
+                if (n <= m || Atomic::compareExchange(&t.max_working, m, n)) { break; }
+            }
+            long long spin = SystemTime::mono() + 10 * NANOSECONDS_IN_MICROSECOND;
+            while (SystemTime::mono() < spin) { Atomic::pause(); }
+            Atomic::add(&t.working, -1);
+        } else if (c.key == (void*)TEST_BLOCK) { // frees the only slot for the TEST_UNBLOCK worker
+            int r = t.unblock->wait(10LL * NANOSECONDS_IN_SECOND);
+            assert(r == EVENT_WAIT_OBJECT_0);
+        } else if (c.key == (void*)TEST_UNBLOCK) {
+            t.unblock->set();
+        } else if (c.key == (void*)TEST_WHO) {
+            t.who = w.id;
+        }
+        Atomic::add(&t.completed, 1);
+    }
+    return null;
+}
+
+static void testCompletionPort() {
+    Completion c[8];
+    {
+        CompletionPort port(2);
+        bool got = port.get(c[0], 0);
+        assert(!got);
+        long long time = SystemTime::mono();
+        got = port.get(c[0], NANOSECONDS_IN_MILLISECOND);
+        assert(!got);
+        assert(SystemTime::mono() - time >= NANOSECONDS_IN_MILLISECOND);
+        for (int i = 1; i <= 3; i++) { port.post((void*)(long long)i, &c, i * 10); }
+        got = port.get(c[0]);
+        assert(got && c[0].key == (void*)1 && c[0].overlapped == &c && c[0].bytes == 10);
+        int n = port.getMany(c, (int)countof(c), 0);
+        assert(n == 2 && c[0].key == (void*)2 && c[1].key == (void*)3 && c[1].bytes == 30); // FIFO
+    }
+    Event unblock(true, false);
+    CompletionPort port(2);
+    TestPort t = {&port, &unblock, 0, 0, 0, -1};
+    TestWorker w[6];
+    Thread* threads[countof(w)];
+    for (int i = 0; i < (int)countof(w); i++) {
+        w[i].t = &t;
+        w[i].id = i;
+        threads[i] = new Thread(test_port_worker, &w[i]);
+        SystemTime::sleep(NANOSECONDS_IN_MILLISECOND * 20); // becomes idle before the next one
+    }
+    port.post((void*)TEST_WHO);
+    while (Atomic::load(&t.completed) < 1) { SystemTime::sleep(NANOSECONDS_IN_MILLISECOND); }
+    assert(t.who == (int)countof(w) - 1); // most recently idle worker is woken first
+    for (int i = 0; i < 2000; i++) { port.post((void*)TEST_WORK); }
+    port.post((void*)TEST_BLOCK);
+    port.post((void*)TEST_BLOCK); // both slots blocked: only blocked-worker tracking lets these run
+    port.post((void*)TEST_UNBLOCK);
+    for (int i = 0; i < (int)countof(w); i++) { port.post(null); }
+    for (int i = 0; i < (int)countof(w); i++) { threads[i]->join(); delete threads[i]; }
+    assert(t.completed == 1 + 2000 + 3);
+    assert(t.max_working > 0 && t.max_working <= 2);
+}
+
+static void* test_promise(void* p) {
+    SystemTime::sleep(NANOSECONDS_IN_MILLISECOND * 5);
+    ((Promise<int>*)p)->set(42);
+    return null;
+}
+
+static int test_twice(void* p) {
+    return (int)(long long)p * 2;
+}
+
+static long long test_square(const int& v, void*) {
+    return (long long)v * v;
+}
+
+static int test_next(const int& v, void* arg) {
+    Atomic::add((volatile int*)arg, 1);
+    return v + 1;
+}
+
+static void testFuture() {
+    Promise<int> promise;
+    Future<int> f = promise.future();
+    assert(!f.isReady());
+    int r = f.wait(NANOSECONDS_IN_MILLISECOND);
+    assert(r == EVENT_WAIT_TIMEOUT);
+    Thread thread(test_promise, &promise);
+    int v = f.get();
+    assert(v == 42 && f.isReady());
+    thread.join();
+    Promise<int> a;
+    Promise<int> b;
+    b.set(7);
+    r = Event::waitAny(0, a.future().event(), b.future().event());
+    assert(r == EVENT_WAIT_OBJECT_0 + 1);
+    r = Event::waitAny(0, b.future().event(), a.future().event());
+    assert(r == EVENT_WAIT_OBJECT_0); // stays signaled
+    {
+        ThreadPool pool(2, 2);
+        Future<long long> squared = async(pool, test_twice, (void*)10).then(pool, test_square);
+        long long s = squared.get();
+        assert(s == 400);
+        Future<long long> late = f.then(pool, test_square); // already ready: submitted at once
+        s = late.get();
+        assert(s == 42 * 42);
+    }
+    enum { STAGES = 1000 };
+    ThreadPool pool(1, 1); // a single worker runs the whole graph: no stage blocks it
+    volatile int ran = 0;
+    Promise<int> first;
+    Future<int> last = first.future();
+    for (int i = 0; i < STAGES; i++) { last = last.then(pool, test_next, (void*)&ran); }
+    Future<int> fan[8] = {last, last, last, last, last, last, last, last};
+    for (int i = 0; i < (int)countof(fan); i++) { fan[i] = last.then(pool, test_next, (void*)&ran); }
+    r = last.wait(NANOSECONDS_IN_MILLISECOND);
+    assert(ran == 0 && r == EVENT_WAIT_TIMEOUT);
+    first.set(0);
+    for (int i = 0; i < (int)countof(fan); i++) {
+        v = fan[i].get();
+        assert(v == STAGES + 1);
+    }
+    v = last.get();
+    assert(v == STAGES && ran == STAGES + (int)countof(fan));
+}
+
+struct TestQueue {
+    MPMCQueue<int>* queue;
+    int items;
+    long long volatile sum;
+};
+
+static void* test_queue_producer(void* p) {
+    TestQueue &t = *(TestQueue*)p;
+    for (int i = 1; i <= t.items; i++) { t.queue->push(i); }
+    return null;
+}
+
+static void* test_queue_consumer(void* p) {
+    TestQueue &t = *(TestQueue*)p;
+    long long sum = 0;
+    int v = 0;
+    while (t.queue->pop(v) && v > 0) { sum += v; }
+    Atomic::add(&t.sum, sum);
+    return null;
+}
+
+static void testEventCount() {
+    EventCount ec;
+    EventCount::Key key = ec.prepareWait();
+    ec.notify();
+    int r = ec.commitWait(key);
+    assert(r == EVENT_WAIT_OBJECT_0); // notified after prepareWait(): no sleep
+    key = ec.prepareWait();
+    r = ec.commitWait(key, NANOSECONDS_IN_MILLISECOND);
+    assert(r == EVENT_WAIT_TIMEOUT);
+    ec.prepareWait();
+    ec.cancelWait();
+    ec.notify(); // nobody waits: no wakeup
+    MPMCQueue<int> small(3);
+    for (int i = 0; i < 4; i++) {
+        bool pushed = small.tryPush(i);
+        assert(pushed);
+    }
+    bool pushed = small.tryPush(4);
+    assert(!pushed); // capacity rounded up to 4
+    int v = -1;
+    for (int i = 0; i < 4; i++) {
+        bool popped = small.tryPop(v);
+        assert(popped && v == i);
+    }
+    bool popped = small.tryPop(v);
+    assert(!popped);
+    popped = small.pop(v, NANOSECONDS_IN_MILLISECOND);
+    assert(!popped);
+    enum { N = 4 };
+    MPMCQueue<int> queue(16); // small: producers and consumers both sleep
+    TestQueue t = {&queue, 20000, 0};
+    Thread* producers[N];
+    Thread* consumers[N];
+    for (int i = 0; i < N; i++) {
+        producers[i] = new Thread(test_queue_producer, &t);
+        consumers[i] = new Thread(test_queue_consumer, &t);
+    }
+    for (int i = 0; i < N; i++) { producers[i]->join(); delete producers[i]; }
+    for (int i = 0; i < N; i++) { queue.push(0); } // one stop value per consumer
+    for (int i = 0; i < N; i++) { consumers[i]->join(); delete consumers[i]; }
+    assert(t.sum == (long long)N * t.items * (t.items + 1) / 2);
+}
+
 static int testAll() {
+    testVirtualClock();
+    SystemTime::virtualClock(true); // Event timeouts and sleeps below take no real time
     test1();
     test2();
+    testWaitAll();
+    SystemTime::virtualClock(false);
+    testNamed();
+    testRealtime();
+    testSRWLock();
+    testBarrier();
+    testThreadOptions();
+    testFiber();
+    testApc();
+    testCompactEvent();
+    testBroadcast();
+    testThreadTimes();
+    testMessages();
+    testCompletionPort();
+    testFuture();
+    testEventCount();
+    SystemTime::virtualClock(true);
     Thread t1(wait_multiple);
     Thread t2(wait_multiple);
     Thread t3(wait_multiple);
@@ -187,10 +1220,482 @@ static int testAll() {
     t2.join();
     t3.join();
     assert(strcmp(r, "wait_multiple") == 0);
+    SystemTime::virtualClock(false);
+#ifdef EVENT_TRACE
+    bool dumped = Trace::dump("event.trace"); // see tools/trace2json.cpp
+    assert(dumped);
+#endif
     printf("done\n");
     return 0;
 }
 
-int main(int, const char **) {
-    testAll();
+struct BenchReaders {
+    SRWLock srw;
+#ifndef WIN32
+    pthread_rwlock_t rw;
+#endif
+    bool pthread;
+    int iterations;
+    volatile int table[16]; // read-mostly "routing table"
+};
+
+static void* bench_readers(void* p) {
+    BenchReaders &b = *(BenchReaders*)p;
+    int sum = 0;
+    for (int i = 0; i < b.iterations; i++) {
+#ifndef WIN32
+        if (b.pthread) {
+            pthread_rwlock_rdlock(&b.rw);
+            sum += b.table[i % countof(b.table)];
+            pthread_rwlock_unlock(&b.rw);
+            continue;
+        }
+#endif
+        b.srw.acquireShared();
+        sum += b.table[i % countof(b.table)];
+        b.srw.releaseShared();
+    }
+    return (void*)(long)sum;
+}
+
+static void benchSRWLock() {
+    BenchReaders b;
+    memset((void*)b.table, 0, sizeof(b.table));
+    b.iterations = 1000000;
+#ifndef WIN32
+    pthread_rwlock_init(&b.rw, null);
+#endif
+    for (int k = 0; k < 2; k++) {
+        b.pthread = k == 1;
+        for (int n = 1; n <= 16; n *= 2) {
+            Thread* t[16];
+            long long time = SystemTime::mono();
+            for (int i = 0; i < n; i++) { t[i] = new Thread(bench_readers, &b); }
+            for (int i = 0; i < n; i++) { t[i]->join(); delete t[i]; }
+            time = SystemTime::mono() - time;
+            printf("%-16s readers=%-2d %6.1f ns/op\n", b.pthread ? "pthread_rwlock" : "SRWLock", n,
+                   (double)time / ((double)n * b.iterations));
+        }
+#ifdef WIN32
+        break;
+#endif
+    }
+#ifndef WIN32
+    pthread_rwlock_destroy(&b.rw);
+#endif
+}
+
+struct BenchBarrier {
+    Barrier* barrier;
+    DisseminationBarrier* dissemination;
+    int phases;
+    volatile int next_id;
+};
+
+static void* bench_barrier(void* p) {
+    BenchBarrier &b = *(BenchBarrier*)p;
+    int id = Atomic::add(&b.next_id, 1) - 1;
+    for (int i = 0; i < b.phases; i++) {
+        if (b.barrier != null) {
+            b.barrier->enter();
+        } else {
+            b.dissemination->enter(id);
+        }
+    }
+    return null;
+}
+
+static void benchBarrier() {
+    enum { THREADS = 64 };
+    const char* names[] = {"Barrier", "Barrier(spin)", "DisseminationBarrier"};
+    for (int k = 0; k < 3; k++) {
+        Barrier barrier(THREADS, k == 1 ? 1000 : 0);
+        DisseminationBarrier dissemination(THREADS);
+        BenchBarrier b;
+        b.barrier = k < 2 ? &barrier : null;
+        b.dissemination = k < 2 ? null : &dissemination;
+        b.phases = 1000;
+        b.next_id = 0;
+        Thread* t[THREADS];
+        long long time = SystemTime::mono();
+        for (int i = 0; i < THREADS; i++) { t[i] = new Thread(bench_barrier, &b); }
+        for (int i = 0; i < THREADS; i++) { t[i]->join(); delete t[i]; }
+        time = SystemTime::mono() - time;
+        printf("%-20s threads=%d %8.1f us/phase\n", names[k], THREADS,
+               (double)time / b.phases / NANOSECONDS_IN_MICROSECOND);
+    }
+}
+
+struct BenchWaitAll {
+    Event* a;
+    Event* b;
+    int iterations;
+};
+
+static void* bench_wait_all(void* p) {
+    BenchWaitAll &b = *(BenchWaitAll*)p;
+    for (int i = 0; i < b.iterations; i++) {
+        if (i % 2 == 0) {
+            Event::waitAll(*b.a, *b.b);
+        } else {
+            Event::waitAll(*b.b, *b.a);
+        }
+    }
+    return null;
+}
+
+static void benchWaitAll() {
+    Event a(true, true);
+    Event b(true, true);
+    BenchWaitAll bench = {&a, &b, 200000};
+    for (int n = 1; n <= 16; n *= 2) {
+        Thread* t[16];
+        long long time = SystemTime::mono();
+        for (int i = 0; i < n; i++) { t[i] = new Thread(bench_wait_all, &bench); }
+        for (int i = 0; i < n; i++) { t[i]->join(); delete t[i]; }
+        time = SystemTime::mono() - time;
+        printf("waitAll(a, b)        threads=%-2d %6.1f ns/op\n", n, (double)time / ((double)n * bench.iterations));
+    }
+}
+
+static void* bench_small_stack(void* p) {
+    return p;
+}
+
+static void benchSmallStacks() {
+    enum { N = 10000 };
+    Thread** t = new Thread*[N];
+    ThreadOptions o;
+    o.name = "small";
+    o.stack_size = 16 * 1024;
+    long long time = SystemTime::mono();
+    for (int i = 0; i < N; i++) { t[i] = new Thread(bench_small_stack, null, o); }
+    for (int i = 0; i < N; i++) { t[i]->join(); delete t[i]; }
+    time = SystemTime::mono() - time;
+    printf("%d threads 16KB stack  %6.1f us/thread create+join\n", N, (double)time / N / NANOSECONDS_IN_MICROSECOND);
+    delete[] t;
+}
+
+static void benchTrace() {
+#ifdef EVENT_TRACE
+    enum { N = 10000000 };
+    long long time = SystemTime::mono();
+    for (int i = 0; i < N; i++) {
+        TRACE(TRACE_SET, &time);
+    }
+    time = SystemTime::mono() - time;
+    printf("TRACE()              %6.1f ns/record\n", (double)time / N);
+#endif
+}
+
+static void bench_fiber_yield(void* p) {
+    for (int i = 0; i < *(int*)p; i++) { FiberScheduler::yield(); }
+}
+
+static void bench_fiber_wait(void* p) {
+    ((Event*)p)->wait();
+}
+
+static void bench_fiber_set(void* p) {
+    FiberScheduler::yield();
+    ((Event*)p)->set();
+}
+
+static void benchFiber() {
+    int yields = 1000000;
+    FiberScheduler pair;
+    pair.spawn(bench_fiber_yield, &yields);
+    pair.spawn(bench_fiber_yield, &yields);
+    long long time = SystemTime::mono();
+    pair.run();
+    time = SystemTime::mono() - time;
+    printf("FiberScheduler::yield() %6.1f ns/switch\n", (double)time / (2.0 * yields));
+    enum { N = 100000 };
+    Event go(true, false);
+    FiberScheduler scheduler;
+    time = SystemTime::mono();
+    for (int i = 0; i < N; i++) { scheduler.spawn(bench_fiber_wait, &go); }
+    scheduler.spawn(bench_fiber_set, &go);
+    scheduler.run();
+    time = SystemTime::mono() - time;
+    printf("%d fibers Event::wait() %6.1f us/fiber spawn+park+wake\n", N, (double)time / N / NANOSECONDS_IN_MICROSECOND);
+}
+
+struct BenchApc {
+    Event* never;
+    int volatile ran;
+    int iterations;
+};
+
+static void bench_apc(void* p) {
+    ((BenchApc*)p)->ran++;
+}
+
+static void* bench_apc_thread(void* p) {
+    BenchApc &b = *(BenchApc*)p;
+    while (b.ran < b.iterations) {
+        b.never->waitEx(EVENT_INFINITE, true);
+    }
+    return null;
+}
+
+static void benchApc() {
+    Event never;
+    BenchApc b = {&never, 0, 1000000};
+    long long time = SystemTime::mono();
+    Thread thread(bench_apc_thread, &b);
+    for (int i = 0; i < b.iterations; i++) { thread.queueApc(bench_apc, &b); }
+    thread.join();
+    time = SystemTime::mono() - time;
+    printf("queueApc()           %6.1f ns/apc delivered\n", (double)time / b.iterations);
+}
+
+struct BenchPingPong {
+    Event* ping;
+    Event* pong;
+    CompactEvent* compact_ping;
+    CompactEvent* compact_pong;
+    int iterations;
+};
+
+static void* bench_pong(void* p) {
+    BenchPingPong &b = *(BenchPingPong*)p;
+    for (int i = 0; i < b.iterations; i++) {
+        if (b.ping != null) { b.ping->wait(); b.pong->set(); }
+        else { b.compact_ping->wait(); b.compact_pong->set(); }
+    }
+    return null;
+}
+
+static void benchCompactEvent() {
+    printf("sizeof(Event) %d sizeof(CompactEvent) %d bytes\n", (int)sizeof(Event), (int)sizeof(CompactEvent));
+    Event ping;
+    Event pong;
+    CompactEvent compact_ping;
+    CompactEvent compact_pong;
+    for (int k = 0; k < 2; k++) {
+        BenchPingPong b = {k == 0 ? &ping : null, k == 0 ? &pong : null, &compact_ping, &compact_pong, 100000};
+        long long time = SystemTime::mono();
+        Thread thread(bench_pong, &b);
+        for (int i = 0; i < b.iterations; i++) {
+            if (k == 0) { ping.set(); pong.wait(); }
+            else { compact_ping.set(); compact_pong.wait(); }
+        }
+        thread.join();
+        time = SystemTime::mono() - time;
+        printf("%-20s %6.1f us/round trip\n", k == 0 ? "Event ping-pong" : "CompactEvent", (double)time / b.iterations / NANOSECONDS_IN_MICROSECOND);
+    }
+}
+
+static void* bench_broadcast_wait(void* p) {
+    ((Event*)p)->wait();
+    return null;
+}
+
+static void benchBroadcast() {
+    enum { N = 2000 };
+    Event e(true, false);
+    ThreadOptions options;
+    options.stack_size = 64 * 1024;
+    Thread* threads[N];
+    for (int i = 0; i < N; i++) { threads[i] = new Thread(bench_broadcast_wait, &e, options); }
+    SystemTime::sleep(NANOSECONDS_IN_SECOND / 4);
+    long long time = SystemTime::mono();
+    long long cpu = SystemTime::cpu();
+    e.set();
+    cpu = SystemTime::cpu() - cpu; // woken waiters may preempt the setter: wall time would include them
+    for (int i = 0; i < N; i++) { threads[i]->join(); delete threads[i]; }
+    time = SystemTime::mono() - time;
+    printf("manual-reset set() %d waiters %6.1f us cpu, all joined %6.1f ms\n", (int)N,
+           (double)cpu / NANOSECONDS_IN_MICROSECOND, (double)time / NANOSECONDS_IN_MILLISECOND);
+}
+
+struct BenchMessages {
+    Thread* actor;
+    int messages;
+    int volatile received;
+};
+
+static void* bench_actor(void* p) {
+    BenchMessages &b = *(BenchMessages*)p;
+    ThreadMessage m[256];
+    while (b.received < b.messages) {
+        Event::waitAnyOrMessage(EVENT_INFINITE, 0, null);
+        b.received += Thread::peekMessages(m, countof(m));
+    }
+    return null;
+}
+
+static void* bench_post(void* p) {
+    BenchMessages &b = *(BenchMessages*)p;
+    for (int i = 0; i < b.messages / 4; i++) { b.actor->postMessage(0x0400); }
+    return null;
+}
+
+static void benchMessages() {
+    BenchMessages b = {null, 4000000, 0};
+    long long time = SystemTime::mono();
+    Thread actor(bench_actor, &b);
+    b.actor = &actor;
+    Thread* producers[4];
+    for (int i = 0; i < 4; i++) { producers[i] = new Thread(bench_post, &b); }
+    for (int i = 0; i < 4; i++) { producers[i]->join(); delete producers[i]; }
+    actor.join();
+    time = SystemTime::mono() - time;
+    printf("postMessage() 4:1    %6.1f ns/message\n", (double)time / b.messages);
+}
+
+struct BenchPort {
+    CompletionPort* port;
+    int batch;
+    int volatile completed;
+};
+
+static void* bench_port_worker(void* p) {
+    BenchPort &b = *(BenchPort*)p;
+    Completion c[64];
+    for (;;) {
+        int n = b.port->getMany(c, b.batch);
+        for (int i = 0; i < n; i++) {
+            if (c[i].key == null) { // quit: give the other quit completions back
+                for (int j = i + 1; j < n; j++) { b.port->post(c[j].key); }
+                Atomic::add(&b.completed, i);
+                return null;
+            }
+        }
+        Atomic::add(&b.completed, n);
+    }
+}
+
+static void benchCompletionPort() {
+    const int N = 1000000;
+    for (int k = 0; k < 3; k++) {
+        int concurrency = k == 0 ? 1 : 4;
+        CompletionPort port(concurrency);
+        BenchPort b = {&port, k == 2 ? 64 : 1, 0};
+        Thread* workers[8];
+        for (int i = 0; i < (int)countof(workers); i++) { workers[i] = new Thread(bench_port_worker, &b); }
+        long long time = SystemTime::mono();
+        for (int i = 0; i < N; i++) { port.post((void*)1); }
+        for (int i = 0; i < (int)countof(workers); i++) { port.post(null); }
+        for (int i = 0; i < (int)countof(workers); i++) { workers[i]->join(); delete workers[i]; }
+        time = SystemTime::mono() - time;
+        assert(b.completed == N);
+        printf("CompletionPort concurrency=%d batch=%-2d %6.1f ns/completion\n", concurrency, b.batch, (double)time / N);
+    }
+}
+
+static int bench_next(const int& v, void*) {
+    return v + 1;
+}
+
+static void benchFuture() {
+    enum { STAGES = 200000 };
+    for (int k = 1; k <= 2; k++) {
+        ThreadPool pool(k, k);
+        Promise<int> first;
+        Future<int> last = first.future();
+        for (int i = 0; i < STAGES; i++) { last = last.then(pool, bench_next); }
+        long long time = SystemTime::mono();
+        first.set(0);
+        int r = last.get();
+        assert(r == STAGES);
+        time = SystemTime::mono() - time;
+        printf("Future::then() chain workers=%d %6.1f ns/stage\n", k, (double)time / STAGES);
+    }
+}
+
+struct BenchQueue {
+    MPMCQueue<int>* queue;
+    Event* not_empty; // null: push()/pop() on the queue's EventCounts
+    int items;
+};
+
+static void* bench_queue_producer(void* p) {
+    BenchQueue &b = *(BenchQueue*)p;
+    for (int i = 1; i <= b.items; i++) {
+        if (b.not_empty == null) {
+            b.queue->push(i);
+        } else {
+            while (!b.queue->tryPush(i)) { SystemTime::sleep(0); }
+            b.not_empty->set();
+        }
+    }
+    return null;
+}
+
+static void* bench_queue_consumer(void* p) {
+    BenchQueue &b = *(BenchQueue*)p;
+    int v = 0;
+    for (;;) {
+        if (b.not_empty == null) {
+            b.queue->pop(v);
+        } else {
+            while (!b.queue->tryPop(v)) { b.not_empty->wait(NANOSECONDS_IN_MILLISECOND); }
+        }
+        if (v == 0) {
+            return null;
+        }
+    }
+}
+
+static void benchEventCount() {
+    enum { N = 2, ITEMS = 500000 };
+    for (int k = 0; k < 2; k++) {
+        MPMCQueue<int> queue(1024);
+        Event not_empty;
+        BenchQueue b = {&queue, k == 0 ? null : &not_empty, ITEMS};
+        long long time = SystemTime::mono();
+        Thread* threads[N * 2];
+        for (int i = 0; i < N; i++) {
+            threads[i] = new Thread(bench_queue_producer, &b);
+            threads[N + i] = new Thread(bench_queue_consumer, &b);
+        }
+        for (int i = 0; i < N; i++) { threads[i]->join(); delete threads[i]; }
+        for (int i = 0; i < N; i++) {
+            queue.push(0);
+            not_empty.set();
+        }
+        for (int i = 0; i < N; i++) { threads[N + i]->join(); delete threads[N + i]; }
+        time = SystemTime::mono() - time;
+        printf("MPMCQueue %dP/%dC %-22s %6.1f ns/item\n", (int)N, (int)N, k == 0 ? "push/pop EventCount" : "tryPush + Event::set()",
+               (double)time / (N * ITEMS));
+    }
+    MPMCQueue<int> queue(1024); // nobody sleeping: what a producer pays for the wakeup check
+    Event not_empty;
+    int v = 0;
+    for (int k = 0; k < 2; k++) {
+        long long time = SystemTime::mono();
+        for (int i = 0; i < ITEMS; i++) {
+            queue.push(i);
+            if (k == 1) { not_empty.set(); }
+            queue.pop(v);
+        }
+        time = SystemTime::mono() - time;
+        printf("MPMCQueue 1 thread %-22s %6.1f ns/item\n", k == 0 ? "push/pop EventCount" : "+ Event::set()", (double)time / ITEMS);
+    }
+}
+
+static int benchAll() {
+    benchSRWLock();
+    benchBarrier();
+    benchWaitAll();
+    benchSmallStacks();
+    benchTrace();
+    benchFiber();
+    benchApc();
+    benchCompactEvent();
+    benchBroadcast();
+    benchMessages();
+    benchCompletionPort();
+    benchFuture();
+    benchEventCount();
+    return 0;
+}
+
+int main(int argc, const char** argv) {
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        return benchAll();
+    }
+    return testAll();
 }
\ No newline at end of file
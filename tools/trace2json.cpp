@@ -0,0 +1,152 @@
+/*  Copyright (c) 2013, Leo Kuznetsov
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/* trace2json: converts Trace::dump() output to Chrome/Perfetto trace JSON.
+   usage: trace2json event.trace > event.json
+   Waits become duration slices, set/reset become instant events and every wakeup
+   gets a flow arrow from the most recent set() of the same event, so blocking
+   chains across threads are visible in chrome://tracing or ui.perfetto.dev. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/Trace.h"
+
+#define null NULL
+
+#ifdef WIN32
+#pragma warning(disable: 4514 4820 4996)
+#endif
+
+struct Last { // most recent set() per event object
+    unsigned long long object;
+    Trace::Record* set;
+};
+
+static int compareTime(const void* a, const void* b) {
+    long long ta = ((const Trace::Record*)a)->time;
+    long long tb = ((const Trace::Record*)b)->time;
+    return ta < tb ? -1 : ta > tb ? 1 : 0;
+}
+
+static Last* find(Last* last, int n, unsigned long long object) { // open addressing
+    int i = (int)((object >> 4) % (unsigned long long)n);
+    while (last[i].object != 0 && last[i].object != object) {
+        i = (i + 1) % n;
+    }
+    last[i].object = object;
+    return &last[i];
+}
+
+static void emit(bool &first, const char* ph, const char* name, double us, int tid) {
+    printf("%s\n{\"ph\":\"%s\",\"name\":\"%s\",\"ts\":%.3f,\"pid\":1,\"tid\":%d", first ? "" : ",", ph, name, us, tid);
+    first = false;
+}
+
+int main(int argc, const char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <trace file>\n", argv[0]);
+        return 1;
+    }
+    FILE* f = fopen(argv[1], "rb");
+    if (f == null) {
+        fprintf(stderr, "cannot open %s\n", argv[1]);
+        return 1;
+    }
+    Trace::Header h;
+    if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, "W32PTRC1", sizeof(h.magic)) != 0 ||
+        h.record_size != (int)sizeof(Trace::Record)) {
+        fprintf(stderr, "%s: not a trace file\n", argv[1]);
+        return 1;
+    }
+    Trace::Record* records = (Trace::Record*)malloc((size_t)(h.records + 1) * sizeof(Trace::Record));
+    long long n = (long long)fread(records, sizeof(Trace::Record), (size_t)h.records, f);
+    fclose(f);
+    double ns_per_tick = h.ticks1 != h.ticks0 ? (double)(h.mono1 - h.mono0) / (double)(h.ticks1 - h.ticks0) : 1.0;
+    for (long long i = 0; i < n; i++) { // ticks to nanoseconds since first record
+        records[i].time = (long long)((double)(records[i].time - h.ticks0) * ns_per_tick);
+    }
+    qsort(records, (size_t)n, sizeof(Trace::Record), compareTime);
+    int m = (int)(n * 2 + 1);
+    Last* last = (Last*)calloc((size_t)m, sizeof(Last));
+    int flow = 0;
+    bool first = true;
+    printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (long long i = 0; i < n; i++) {
+        Trace::Record &r = records[i];
+        double us = r.time / 1000.0;
+        switch (r.op) {
+            case TRACE_SET:
+                find(last, m, r.object)->set = &r;
+                emit(first, "i", "set", us, r.thread);
+                printf(",\"s\":\"t\",\"args\":{\"event\":\"0x%llx\"}}", r.object);
+                break;
+            case TRACE_RESET:
+                emit(first, "i", "reset", us, r.thread);
+                printf(",\"s\":\"t\",\"args\":{\"event\":\"0x%llx\"}}", r.object);
+                break;
+            case TRACE_WAIT_BEGIN:
+                emit(first, "B", "wait", us, r.thread);
+                printf(",\"args\":{\"event\":\"0x%llx\"}}", r.object);
+                break;
+            case TRACE_WAKE: {
+                emit(first, "E", "wait", us, r.thread);
+                printf(",\"args\":{\"woken by\":\"0x%llx\"}}", r.object);
+                Trace::Record* s = find(last, m, r.object)->set;
+                if (s != null) {
+                    flow++;
+                    emit(first, "s", "wake", s->time / 1000.0, s->thread);
+                    printf(",\"id\":%d}", flow);
+                    emit(first, "f", "wake", us, r.thread);
+                    printf(",\"id\":%d,\"bp\":\"e\"}", flow);
+                }
+                break;
+            }
+            case TRACE_TIMEOUT:
+                emit(first, "E", "wait", us, r.thread);
+                printf(",\"args\":{\"timeout\":\"0x%llx\"}}", r.object);
+                break;
+            case TRACE_THREAD_START:
+                emit(first, "M", "thread_name", us, r.thread);
+                printf(",\"args\":{\"name\":\"Thread 0x%llx\"}}", r.object);
+                emit(first, "i", "start", us, r.thread);
+                printf(",\"s\":\"t\"}");
+                break;
+            case TRACE_THREAD_EXIT:
+                emit(first, "i", "exit", us, r.thread);
+                printf(",\"s\":\"t\"}");
+                break;
+            default:
+                break;
+        }
+    }
+    printf("\n]}\n");
+    free(last);
+    free(records);
+    return 0;
+}
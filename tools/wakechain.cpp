@@ -0,0 +1,242 @@
+/*  Copyright (c) 2013, Leo Kuznetsov
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+
+ * Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/* wakechain: causal wake-chain profile of a Trace::dump() file (built with -DEVENT_TRACE).
+   usage: wakechain event.trace [thread]
+   Every Event wait that was ended by a set() carries the setter's trace thread and set()
+   time (TRACE_WOKEN_BY). The blocked time of each wait is attributed to the waker -> wakee
+   edge, and the critical path is walked backwards from the end of the given trace thread
+   (default: the thread with the latest record): while the thread runs the time is its own,
+   at a wait ended by set() the path jumps to the setter at the time of set(). Waits ended by
+   timeouts or by events without causes (CompactEvent, Win32, named events) stay on the thread.
+   The newest TRACE_RING_SIZE records per thread survive, older waits are not seen. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/Trace.h"
+
+#define null NULL
+
+#ifdef WIN32
+#pragma warning(disable: 4514 4820 4996)
+#endif
+
+struct Wait {
+    long long begin;  // nanoseconds since first record
+    long long end;
+    int thread;
+    int setter;       // 0: timeout or unknown
+    long long set;    // time of the set() that ended the wait
+};
+
+struct Edge { // waker -> wakee
+    int waker;
+    int wakee;
+    long long blocked;
+    long long max;
+    int waits;
+};
+
+struct ThreadInfo {
+    Wait* waits; // in time order
+    int count;
+    long long first;
+    long long last;
+    long long running;      // on the critical path
+    long long blocked;      // on the critical path: timeouts and waits without cause
+    unsigned long long object; // Thread* from TRACE_THREAD_START, 0 for other threads
+};
+
+static Edge* findEdge(Edge* edges, int n, int waker, int wakee) { // open addressing
+    unsigned int i = (unsigned int)(waker * 31 + wakee) % (unsigned int)n;
+    while (edges[i].waits != 0 && (edges[i].waker != waker || edges[i].wakee != wakee)) {
+        i = (i + 1) % (unsigned int)n;
+    }
+    edges[i].waker = waker;
+    edges[i].wakee = wakee;
+    return &edges[i];
+}
+
+static int compareBlocked(const void* a, const void* b) {
+    long long ba = ((const Edge*)a)->blocked;
+    long long bb = ((const Edge*)b)->blocked;
+    return ba > bb ? -1 : ba < bb ? 1 : 0;
+}
+
+static double ms(long long ns) {
+    return ns / 1000000.0;
+}
+
+int main(int argc, const char** argv) {
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "usage: %s <trace file> [thread]\n", argv[0]);
+        return 1;
+    }
+    FILE* f = fopen(argv[1], "rb");
+    if (f == null) {
+        fprintf(stderr, "cannot open %s\n", argv[1]);
+        return 1;
+    }
+    Trace::Header h;
+    if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, "W32PTRC1", sizeof(h.magic)) != 0 ||
+        h.record_size != (int)sizeof(Trace::Record)) {
+        fprintf(stderr, "%s: not a trace file\n", argv[1]);
+        return 1;
+    }
+    Trace::Record* records = (Trace::Record*)malloc((size_t)(h.records + 1) * sizeof(Trace::Record));
+    long long n = (long long)fread(records, sizeof(Trace::Record), (size_t)h.records, f);
+    fclose(f);
+    double ns_per_tick = h.ticks1 != h.ticks0 ? (double)(h.mono1 - h.mono0) / (double)(h.ticks1 - h.ticks0) : 1.0;
+    int threads = h.threads + 1; // trace thread ids start at 1
+    ThreadInfo* info = (ThreadInfo*)calloc((size_t)threads, sizeof(ThreadInfo));
+    Wait* waits = (Wait*)calloc((size_t)(n + 1), sizeof(Wait));
+    int count = 0;
+    long long* begin = (long long*)calloc((size_t)threads, sizeof(long long));
+    for (long long i = 0; i < n; i++) { // rings are dumped one after another, oldest first
+        Trace::Record &r = records[i];
+        if (r.thread <= 0 || r.thread >= threads) {
+            continue;
+        }
+        long long t = (long long)((double)(r.time - h.ticks0) * ns_per_tick);
+        ThreadInfo &ti = info[r.thread];
+        if (r.op != TRACE_WOKEN_BY) {
+            if (ti.waits == null) { ti.first = t; ti.waits = &waits[count]; }
+            ti.last = t;
+        }
+        switch (r.op) {
+            case TRACE_THREAD_START:
+                ti.object = r.object;
+                break;
+            case TRACE_WAIT_BEGIN:
+                begin[r.thread] = t;
+                break;
+            case TRACE_WAKE:
+            case TRACE_TIMEOUT:
+                if (begin[r.thread] != 0) {
+                    Wait &w = waits[count++];
+                    w.begin = begin[r.thread];
+                    w.end = t;
+                    w.thread = r.thread;
+                    ti.count++;
+                    begin[r.thread] = 0;
+                }
+                break;
+            case TRACE_WOKEN_BY: // right after its TRACE_WAKE
+                if (count > 0 && waits[count - 1].thread == r.thread && waits[count - 1].setter == 0 &&
+                    (int)r.object > 0 && (int)r.object < threads) {
+                    waits[count - 1].setter = (int)r.object;
+                    waits[count - 1].set = t;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    int m = count * 2 + 1;
+    Edge* edges = (Edge*)calloc((size_t)m, sizeof(Edge));
+    long long caused = 0;
+    for (int i = 0; i < count; i++) {
+        Wait &w = waits[i];
+        if (w.setter != 0) {
+            Edge* e = findEdge(edges, m, w.setter, w.thread);
+            long long blocked = w.end - w.begin;
+            e->blocked += blocked;
+            e->max = blocked > e->max ? blocked : e->max;
+            e->waits++;
+            caused++;
+        }
+    }
+    int end = argc == 3 ? atoi(argv[2]) : 0;
+    for (int i = 1; i < threads && argc != 3; i++) {
+        if (info[i].waits != null && (end == 0 || info[i].last > info[end].last)) {
+            end = i;
+        }
+    }
+    if (end <= 0 || end >= threads || info[end].waits == null) {
+        fprintf(stderr, "%s: no records of thread %d\n", argv[1], end);
+        return 1;
+    }
+    printf("%lld records, %d threads, %d waits, %lld with waker\n\n", n, threads - 1, count, caused);
+    // critical path: backwards from the end of thread "end"
+    int thread = end;
+    long long t = info[end].last;
+    long long latency = 0; // set() to the woken thread running
+    int hops = 0;
+    for (int steps = 0; steps <= count; steps++) {
+        ThreadInfo &ti = info[thread];
+        int k = ti.count - 1;
+        while (k >= 0 && ti.waits[k].end > t) { k--; }
+        if (k < 0) {
+            ti.running += t - ti.first > 0 ? t - ti.first : 0;
+            t = ti.first;
+            break;
+        }
+        Wait &w = ti.waits[k];
+        ti.running += t - w.end;
+        if (w.setter != 0 && w.set <= w.end && w.setter != thread) {
+            latency += w.end - w.set;
+            thread = w.setter;
+            t = w.set;
+            hops++;
+        } else {
+            ti.blocked += w.end - w.begin;
+            t = w.begin;
+        }
+    }
+    printf("critical path ending on thread %d: %.3f ms from thread %d at %.3f ms, %d wakeups\n",
+           end, ms(info[end].last - t), thread, ms(t), hops);
+    printf("   running ms  blocked ms  thread\n");
+    for (int i = 1; i < threads; i++) {
+        if (info[i].running > 0 || info[i].blocked > 0) {
+            printf("  %11.3f %11.3f  %d", ms(info[i].running), ms(info[i].blocked), i);
+            if (info[i].object != 0) {
+                printf(" (Thread 0x%llx)", info[i].object);
+            }
+            printf("\n");
+        }
+    }
+    printf("  %11.3f              wake latency (set to running)\n\n", ms(latency));
+    int edge_count = 0;
+    for (int i = 0; i < m; i++) {
+        if (edges[i].waits != 0) { edges[edge_count++] = edges[i]; }
+    }
+    qsort(edges, (size_t)edge_count, sizeof(Edge), compareBlocked);
+    printf("top waker -> wakee edges by blocked time:\n");
+    printf("   blocked ms   waits      max ms  waker -> wakee\n");
+    for (int i = 0; i < edge_count && i < 20; i++) {
+        printf("  %11.3f %7d %11.3f  %d -> %d\n", ms(edges[i].blocked), edges[i].waits, ms(edges[i].max),
+               edges[i].waker, edges[i].wakee);
+    }
+    free(edges);
+    free(begin);
+    free(waits);
+    free(info);
+    free(records);
+    return 0;
+}